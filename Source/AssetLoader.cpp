@@ -0,0 +1,119 @@
+#include "AssetLoader.hpp"
+#include <SDL_image.h>
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+
+namespace gobl
+{
+    void AssetLoader::Start(unsigned int threads)
+    {
+        if (workers.empty() == false) return;
+
+        if (threads == 0) threads = std::max(1, SDL_GetCPUCount() - 1);
+
+        stopping = false;
+        for (unsigned int i = 0; i < threads; i++) workers.emplace_back(&AssetLoader::WorkerLoop, this);
+    }
+
+    void AssetLoader::Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+
+        wake.notify_all();
+        for (auto& worker : workers) worker.join();
+        workers.clear();
+    }
+
+    AssetLoader::~AssetLoader()
+    {
+        Stop();
+
+        for (auto& image : images) SDL_FreeSurface(image.surface);
+        images.clear();
+    }
+
+    void AssetLoader::WorkerLoop()
+    {
+        while (true)
+        {
+            LoadJob job{};
+
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || jobs.empty() == false; });
+
+                // Drain the queue before leaving so Stop never drops work
+                if (jobs.empty()) return;
+
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+
+            if (job.work) job.work();
+            else
+            {
+                SDL_Surface* surface = nullptr;
+                SDL_Surface* loaded = IMG_Load(job.path.c_str());
+
+                if (loaded != nullptr)
+                {
+                    surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+                    SDL_FreeSurface(loaded);
+                }
+
+                if (surface == nullptr) std::cout << "Unable to load image: " << job.path << std::endl;
+                else
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    images.push_back({ job.path, surface });
+                }
+            }
+
+            completed++;
+        }
+    }
+
+    void AssetLoader::QueueImage(const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({ path, {} });
+            queued++;
+        }
+
+        wake.notify_one();
+    }
+
+    void AssetLoader::QueueDirectory(const char* directory, const char* extension)
+    {
+        for (const auto& file : std::filesystem::recursive_directory_iterator(directory))
+        {
+            if (file.is_directory() || file.path().extension() != extension) continue;
+
+            QueueImage(std::string(directory) + std::filesystem::relative(file.path(), directory).generic_string());
+        }
+    }
+
+    void AssetLoader::QueueJob(std::function<void()> job)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back({ "", std::move(job) });
+            queued++;
+        }
+
+        wake.notify_one();
+    }
+
+    void AssetLoader::TakeImages(std::vector<LoadedImage>& out)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        for (auto& image : images) out.push_back(image);
+        images.clear();
+    }
+}
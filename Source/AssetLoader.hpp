@@ -0,0 +1,73 @@
+#pragma once
+#ifndef ASSET_LOADER_HPP
+#define ASSET_LOADER_HPP
+
+#include <SDL.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Decodes files on worker threads, the main thread only collects the results and uploads them
+namespace gobl
+{
+    struct LoadedImage
+    {
+        std::string path;
+        SDL_Surface* surface = nullptr; // RGBA32, owned by whoever takes it
+    };
+
+    class AssetLoader
+    {
+    private:
+        struct LoadJob
+        {
+            std::string path{}; // Image to decode when work is empty
+            std::function<void()> work{};
+        };
+
+        std::vector<std::thread> workers{};
+        std::deque<LoadJob> jobs{};
+        std::vector<LoadedImage> images{};
+
+        std::mutex mutex{};
+        std::condition_variable wake{};
+        bool stopping = false;
+
+        std::atomic<size_t> queued{ 0 };
+        std::atomic<size_t> completed{ 0 };
+
+        void WorkerLoop();
+
+    public:
+        AssetLoader() = default;
+        ~AssetLoader();
+
+        AssetLoader(const AssetLoader&) = delete;
+        AssetLoader& operator=(const AssetLoader&) = delete;
+
+        // 0 threads uses one less than the number of cores
+        void Start(unsigned int threads = 0);
+        // Finishes the queued work, then joins the workers. Decoded images stay until taken.
+        void Stop();
+
+        void QueueImage(const std::string& path);
+        void QueueDirectory(const char* directory, const char* extension = ".png");
+        // Any other work, it must not touch the renderer
+        void QueueJob(std::function<void()> job);
+
+        // Moves every image decoded so far into out
+        void TakeImages(std::vector<LoadedImage>& out);
+
+        size_t GetQueued() { return queued; }
+        size_t GetCompleted() { return completed; }
+        bool IsDone() { return completed == queued; }
+        float GetProgress() { return queued == 0 ? 1.0f : static_cast<float>(completed) / queued; }
+    };
+}
+
+#endif // !ASSET_LOADER_HPP
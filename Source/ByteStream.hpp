@@ -0,0 +1,85 @@
+#pragma once
+#ifndef BYTE_STREAM_HPP
+#define BYTE_STREAM_HPP
+
+#include <SDL.h>
+#include <cstring>
+#include <vector>
+
+// Raw binary files in native byte order, shared by map saves and render captures
+namespace gobl
+{
+    template<typename T>
+    void Append(std::vector<Uint8>& out, const T& value)
+    {
+        const Uint8* bytes = reinterpret_cast<const Uint8*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    inline void AppendBytes(std::vector<Uint8>& out, const void* data, size_t size)
+    {
+        const Uint8* bytes = static_cast<const Uint8*>(data);
+        out.insert(out.end(), bytes, bytes + size);
+    }
+
+    // A Uint32 count followed by the values
+    template<typename T>
+    void AppendArray(std::vector<Uint8>& out, const std::vector<T>& values)
+    {
+        Append(out, static_cast<Uint32>(values.size()));
+        if (values.empty() == false) AppendBytes(out, values.data(), values.size() * sizeof(T));
+    }
+
+    // Overwrites a value appended earlier, for offsets only known once later data is in
+    template<typename T>
+    void Patch(std::vector<Uint8>& out, size_t pos, const T& value) { std::memcpy(&out[pos], &value, sizeof(T)); }
+
+    // Walks a file held in memory, any read past the end marks it as bad and every later read fails
+    struct ByteReader
+    {
+        const Uint8* data = nullptr;
+        size_t size = 0;
+        size_t pos = 0;
+        bool bad = false;
+
+        bool AtEnd() const { return bad || pos >= size; }
+
+        bool ReadBytes(void* out, size_t count)
+        {
+            if (bad || pos > size || size - pos < count)
+            {
+                bad = true;
+                return false;
+            }
+
+            if (count > 0) std::memcpy(out, data + pos, count);
+            pos += count;
+            return true;
+        }
+
+        template<typename T>
+        T Read()
+        {
+            T value{};
+            ReadBytes(&value, sizeof(T));
+            return value;
+        }
+
+        // Reads what AppendArray wrote, the count is checked against what is left before anything is allocated
+        template<typename T>
+        void ReadArray(std::vector<T>& values)
+        {
+            Uint32 count = Read<Uint32>();
+            if (bad || pos > size || (size - pos) / sizeof(T) < count)
+            {
+                bad = true;
+                return;
+            }
+
+            values.resize(count);
+            ReadBytes(values.data(), count * sizeof(T));
+        }
+    };
+}
+
+#endif // !BYTE_STREAM_HPP
@@ -64,6 +64,14 @@ namespace cSpr
 		return *this;
 	}
 
+	CompositeSprite& CompositeSprite::SetLayer(Sint16 layer)
+	{
+		for (unsigned char i = 0; i < sprLen; i++)
+			sprites[i].SetLayer(layer);
+
+		return *this;
+	}
+
 	void CompositeSprite::SetDimensions(IntVec2 dim)
 	{
 		for (unsigned char i = 0; i < sprLen; i++)
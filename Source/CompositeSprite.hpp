@@ -29,6 +29,7 @@ namespace cSpr
 
 		CompositeSprite& SetPosition(Vec2 pos);
 		CompositeSprite& SetFlipped(bool flipped);
+		CompositeSprite& SetLayer(Sint16 layer);
 
 		void SetDimensions(IntVec2 dim);
 		void SetOffsets(Vec2* offsets) { this->offsets = offsets; }
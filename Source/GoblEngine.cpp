@@ -1,10 +1,37 @@
 #include "GoblEngine.hpp"
+#include "Raster.hpp"
 #include "../libs/json.hpp"
 #include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cctype>
 using json = nlohmann::json;
 
 Clock* Clock::instance = nullptr;
 
+#ifdef GOBL_COUNT_ALLOCATIONS
+#include <cstdlib>
+#include <new>
+
+// Per thread so loader workers and the autosave writer don't show up in the render thread's figures
+thread_local Uint64 goblAllocations = 0;
+
+// Counting every allocation lets the debug overlay prove a frame's render path stays off the heap
+void* operator new(std::size_t size)
+{
+    goblAllocations++;
+
+    if (void* p = std::malloc(size > 0 ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+Uint64 gobl::GetAllocationCount() { return goblAllocations; }
+#else
+Uint64 gobl::GetAllocationCount() { return 0; }
+#endif
+
 // Input manager
 namespace gobl
 {
@@ -14,7 +41,11 @@ namespace gobl
 
         if (eatInput > 0)
         {
-            while (SDL_PollEvent(&event)) if (event.type == SDL_QUIT) return false;
+            while (SDL_PollEvent(&event))
+            {
+                lastInputTime = SDL_GetTicks();
+                if (event.type == SDL_QUIT) return false;
+            }
 
             prevButton = 0;
             mouseButton = 0;
@@ -28,6 +59,8 @@ namespace gobl
 
         while (SDL_PollEvent(&event))
         {
+            lastInputTime = SDL_GetTicks();
+
             switch (event.type)
             {
             case SDL_QUIT:
@@ -46,7 +79,7 @@ namespace gobl
                 break;
             case SDL_MOUSEWHEEL:
 
-                mouseWheel = event.wheel.y;
+                mouseWheel += event.wheel.y;
 
                 break;
 
@@ -109,13 +142,169 @@ const Color Color::BLACK = { 0, 0, 0, 0xFF };
 // Renderer
 namespace gobl 
 {
-    std::vector<SDL_Texture*> TextureManager::textures{};
+    std::vector<TextureManager::TextureSlot> TextureManager::slots{};
+    std::vector<int> TextureManager::freeSlots{};
+    std::unordered_map<SDL_Texture*, int> TextureManager::handles{};
+    std::unordered_map<std::string, int> TextureManager::paths{};
+    size_t TextureManager::liveCount = 0;
+    size_t TextureManager::liveBytes = 0;
+    Uint64 TextureManager::decodes = 0;
+
+    int TextureManager::AllocateSlot(SDL_Texture* texture)
+    {
+        int id = -1;
+
+        if (freeSlots.empty() == false)
+        {
+            id = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            slots.emplace_back();
+            id = static_cast<int>(slots.size() - 1);
+        }
+
+        TextureSlot& slot = slots[id];
+        slot.texture = texture;
+        slot.refs = 1;
+        slot.bytes = 0;
+        slot.key.clear();
+        slot.file.clear();
+
+        if (texture != nullptr)
+        {
+            int w = 0, h = 0;
+            SDL_QueryTexture(texture, NULL, NULL, &w, &h);
+            slot.bytes = static_cast<size_t>(w) * h * sizeof(Uint32);
+
+            handles[texture] = id;
+            liveCount++;
+            liveBytes += slot.bytes;
+        }
+
+        return id;
+    }
+
+    void TextureManager::FreeSlot(int id)
+    {
+        TextureSlot& slot = slots[id];
+
+        if (slot.texture != nullptr)
+        {
+            handles.erase(slot.texture);
+            SDL_DestroyTexture(slot.texture);
+
+            liveCount--;
+            liveBytes -= slot.bytes;
+        }
+        if (slot.key.empty() == false) paths.erase(slot.key);
+
+        // Old handles to this slot stop resolving
+        slot = { nullptr, slot.generation + 1 };
+        freeSlots.push_back(id);
+    }
+
+    void TextureManager::DestroyTexture(int id)
+    {
+        if (id < 0 || static_cast<size_t>(id) >= slots.size() || slots[id].refs == 0) return;
+
+        FreeSlot(id);
+    }
+
+    TextureHandle TextureManager::Load(SDL_Renderer* renderer, const std::string& path)
+    {
+        std::string key = TextureAtlas::GetKey(path);
+
+        auto it = paths.find(key);
+        if (it != paths.end())
+        {
+            slots[it->second].refs++;
+            return { it->second, slots[it->second].generation };
+        }
+
+        std::cout << "Loading texture... " << path << std::endl;
+
+        SDL_Surface* surface = IMG_Load(path.c_str());
+        if (surface == nullptr)
+        {
+            std::cout << "Unable to load image: " << path << std::endl;
+            return {};
+        }
+
+        decodes++;
+
+        return Adopt(renderer, path, surface);
+    }
+
+    TextureHandle TextureManager::Adopt(SDL_Renderer* renderer, const std::string& path, SDL_Surface* surface)
+    {
+        std::string key = TextureAtlas::GetKey(path);
+
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_FreeSurface(surface);
+
+        if (texture == nullptr)
+        {
+            std::cout << "ERROR: " << SDL_GetError() << std::endl;
+            return {};
+        }
+
+        // Replacing an entry leaves the old texture to whoever still holds it
+        auto it = paths.find(key);
+        if (it != paths.end()) slots[it->second].key.clear();
+
+        int id = AllocateSlot(texture);
+        slots[id].key = key;
+        slots[id].file = path;
+        paths[key] = id;
+
+        return { id, slots[id].generation };
+    }
+
+    void TextureManager::Release(TextureHandle handle)
+    {
+        if (IsValid(handle) == false) return;
+
+        if (--slots[handle.id].refs == 0) FreeSlot(handle.id);
+    }
+
+    // Adds the heap allocations the current thread makes while it is alive to a counter
+    struct AllocationScope
+    {
+        Uint64& counter;
+        Uint64 start = 0;
+
+        AllocationScope(Uint64& counter) : counter(counter), start(GetAllocationCount()) {}
+        ~AllocationScope() { counter += GetAllocationCount() - start; }
+    };
 
     struct InitializationData
     {
         bool soundEnabled = true;
         int windowWidth = 1024;
         int windowHeight = 720;
+        HeadlessSettings headless{};
+        PacingSettings pacing{};
+
+        static const char* PacingName(FramePacing mode)
+        {
+            switch (mode)
+            {
+            case PACING_UNCAPPED: return "uncapped";
+            case PACING_CAPPED: return "capped";
+            case PACING_ADAPTIVE: return "adaptive";
+            default: return "vsync";
+            }
+        }
+
+        static FramePacing PacingFromName(const std::string& name)
+        {
+            if (name == "uncapped") return PACING_UNCAPPED;
+            if (name == "capped") return PACING_CAPPED;
+            if (name == "adaptive") return PACING_ADAPTIVE;
+            return PACING_VSYNC;
+        }
 
         // Write JSON to file
         const static void WriteToJson(InitializationData& settings, std::string fileName = "Data/init.json")
@@ -126,6 +315,13 @@ namespace gobl
             j["soundEnabled"] = settings.soundEnabled;
             j["windowWidth"] = settings.windowWidth;
             j["windowHeight"] = settings.windowHeight;
+            j["headless"] = settings.headless.enabled;
+            j["headlessFrames"] = settings.headless.frameLimit;
+            j["captureFrames"] = settings.headless.captureFrames;
+            j["captureDirectory"] = settings.headless.captureDirectory;
+            j["framePacing"] = PacingName(settings.pacing.mode);
+            j["targetFps"] = settings.pacing.targetFps;
+            j["idleFps"] = settings.pacing.idleFps;
             o << j << std::endl;
 
             o.close();
@@ -162,6 +358,15 @@ namespace gobl
                 settings.soundEnabled = j.at("soundEnabled");
                 settings.windowWidth = j.at("windowWidth");
                 settings.windowHeight = j.at("windowHeight");
+
+                // Optional, older settings files don't have them
+                settings.headless.enabled = j.value("headless", false);
+                settings.headless.frameLimit = j.value("headlessFrames", 0U);
+                settings.headless.captureFrames = j.value("captureFrames", std::vector<Uint32>{});
+                settings.headless.captureDirectory = j.value("captureDirectory", settings.headless.captureDirectory);
+                settings.pacing.mode = PacingFromName(j.value("framePacing", std::string(PacingName(settings.pacing.mode))));
+                settings.pacing.targetFps = j.value("targetFps", settings.pacing.targetFps);
+                settings.pacing.idleFps = j.value("idleFps", settings.pacing.idleFps);
             }
 
             std::cout << "Settings loaded." << std::endl;
@@ -175,6 +380,17 @@ namespace gobl
         InitializationData settings;
         InitializationData::LoadJsonData(settings);
 
+        // The command line wins over the settings file
+        if (headless.enabled == false) headless = settings.headless;
+        pacing = settings.pacing;
+
+        // No display or sound card, the dummy drivers keep events and the mixer working
+        if (headless.enabled)
+        {
+            SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+            SDL_setenv("SDL_AUDIODRIVER", "dummy", 1);
+        }
+
         // returns zero on success else non-zero
         if (SDL_Init(SDL_INIT_EVERYTHING) != 0) {
             printf("Error initializing SDL: %s\n", SDL_GetError());
@@ -182,17 +398,32 @@ namespace gobl
             return CriticalError("Unable to init SDL");
         }
 
-        m_window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-            settings.windowWidth, settings.windowHeight, SDL_WINDOW_VULKAN);
+        if (headless.enabled)
+        {
+            std::cout << "Running headless" << std::endl;
 
-        if (m_window == NULL) return CriticalError("Window initialization failed!");
+            // Everything renders in software into this surface
+            headlessSurface = SDL_CreateRGBSurfaceWithFormat(0, settings.windowWidth, settings.windowHeight, 32, SDL_PIXELFORMAT_RGBA32);
+            if (headlessSurface == NULL) return CriticalError("Could not create the offscreen surface!");
 
-        Uint32 render_flags = SDL_RENDERER_ACCELERATED;
-        sdlRenderer = SDL_CreateRenderer(m_window, -1, render_flags);
-        if (sdlRenderer == NULL) return CriticalError("Coult not create SDL_Renderer!");
+            sdlRenderer = SDL_CreateSoftwareRenderer(headlessSurface);
+            if (sdlRenderer == NULL) return CriticalError("Coult not create SDL_Renderer!");
+        }
+        else
+        {
+            m_window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+                settings.windowWidth, settings.windowHeight, SDL_WINDOW_VULKAN);
+
+            if (m_window == NULL) return CriticalError("Window initialization failed!");
+
+            Uint32 render_flags = SDL_RENDERER_ACCELERATED;
+            if (GetVsync()) render_flags |= SDL_RENDERER_PRESENTVSYNC;
+            sdlRenderer = SDL_CreateRenderer(m_window, -1, render_flags);
+            if (sdlRenderer == NULL) return CriticalError("Coult not create SDL_Renderer!");
+        }
 
         bgTex = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_RGBA8888,
-            SDL_TEXTUREACCESS_STATIC, settings.windowWidth, settings.windowHeight);
+            SDL_TEXTUREACCESS_STREAMING, settings.windowWidth, settings.windowHeight);
         if (bgTex == NULL) return CriticalError("Coult not create SDL_Texture!");
 
         m_buffer = new Uint32[settings.windowWidth * settings.windowHeight];
@@ -224,11 +455,322 @@ namespace gobl
             return CriticalError("Unable to load default fonts!");
         }
 
+        if (recordPath.empty() == false) StartRecording();
+
+        return true;
+    }
+
+    std::string TextureAtlas::GetKey(std::string path)
+    {
+        // Paths are written by hand in code and mods, so match them the way the file system does
+        std::replace(path.begin(), path.end(), '\\', '/');
+        std::transform(path.begin(), path.end(), path.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        return path;
+    }
+
+    bool TextureAtlas::Build(SDL_Renderer* renderer, const char* directory)
+    {
+        std::vector<LoadedImage> images{};
+
+        for (const auto& file : std::filesystem::recursive_directory_iterator(directory))
+        {
+            if (file.is_directory() || file.path().extension() != ".png") continue;
+
+            std::string path = std::string(directory) + std::filesystem::relative(file.path(), directory).generic_string();
+            SDL_Surface* loaded = IMG_Load(path.c_str());
+
+            if (loaded == nullptr)
+            {
+                std::cout << "Unable to load image: " << path << std::endl;
+                continue;
+            }
+
+            SDL_Surface* surface = SDL_ConvertSurfaceFormat(loaded, SDL_PIXELFORMAT_RGBA32, 0);
+            SDL_FreeSurface(loaded);
+            if (surface == nullptr) continue;
+
+            images.push_back({ path, surface });
+        }
+
+        Pack(renderer, images);
+
+        // Too large for a page, these load on their own when used
+        for (auto& image : images) SDL_FreeSurface(image.surface);
+
+        return pages.empty() == false;
+    }
+
+    void TextureAtlas::Pack(SDL_Renderer* renderer, std::vector<LoadedImage>& images)
+    {
+        SDL_RendererInfo info{};
+        if (SDL_GetRendererInfo(renderer, &info) == 0 && info.max_texture_width > 0)
+            pageSize = std::min(pageSize, std::min(info.max_texture_width, info.max_texture_height));
+
+        // Shelf pack, tallest first so each shelf wastes as little height as possible
+        std::sort(images.begin(), images.end(), [](const LoadedImage& a, const LoadedImage& b) { return a.surface->h > b.surface->h; });
+
+        std::vector<LoadedImage> oversized{};
+
+        SDL_Surface* page = nullptr;
+        std::vector<std::pair<std::string, SDL_Rect>> pageRegions{};
+        int shelfX = 0, shelfY = 0, shelfH = 0;
+
+        auto flushPage = [&]()
+        {
+            if (page == nullptr) return;
+
+            SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, page);
+            SDL_FreeSurface(page);
+            page = nullptr;
+
+            if (texture == nullptr)
+            {
+                std::cout << "Unable to create atlas page: " << SDL_GetError() << std::endl;
+                pageRegions.clear();
+                return;
+            }
+
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+            int textureId = TextureManager::CreateTexture(texture);
+            pages.push_back(textureId);
+
+            for (auto& r : pageRegions) regions[r.first] = { textureId, r.second };
+            pageRegions.clear();
+        };
+
+        for (auto& image : images)
+        {
+            int w = image.surface->w;
+            int h = image.surface->h;
+
+            // Too large to share a page, these keep their own texture
+            if (w + PADDING > pageSize || h + PADDING > pageSize)
+            {
+                oversized.push_back(image);
+                continue;
+            }
+
+            if (shelfX + w + PADDING > pageSize)
+            {
+                shelfY += shelfH;
+                shelfX = shelfH = 0;
+            }
+
+            if (page != nullptr && shelfY + h + PADDING > pageSize)
+            {
+                flushPage();
+                shelfX = shelfY = shelfH = 0;
+            }
+
+            if (page == nullptr)
+            {
+                page = SDL_CreateRGBSurfaceWithFormat(0, pageSize, pageSize, 32, SDL_PIXELFORMAT_RGBA32);
+                if (page == nullptr)
+                {
+                    SDL_FreeSurface(image.surface);
+                    continue;
+                }
+            }
+
+            SDL_Rect dest{ shelfX, shelfY, w, h };
+
+            // Copy the pixels as they are, alpha included
+            SDL_SetSurfaceBlendMode(image.surface, SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(image.surface, NULL, page, &dest);
+            SDL_FreeSurface(image.surface);
+
+            pageRegions.push_back({ GetKey(image.path), { shelfX, shelfY, w, h } });
+
+            shelfX += w + PADDING;
+            shelfH = std::max(shelfH, h + PADDING);
+        }
+
+        flushPage();
+
+        std::cout << "Packed " << regions.size() << " images into " << pages.size() << " atlas pages." << std::endl;
+
+        images.swap(oversized);
+    }
+
+    void TextureAtlas::Destroy()
+    {
+        for (auto& id : pages) TextureManager::DestroyTexture(id);
+
+        pages.clear();
+        regions.clear();
+    }
+
+    bool TextureAtlas::GetRegion(const char* path, AtlasRegion& region)
+    {
+        auto it = regions.find(GetKey(path));
+        if (it == regions.end()) return false;
+
+        region = it->second;
         return true;
     }
 
+    FontPage* GlyphCache::GetPage(SDL_Renderer* renderer, TTF_Font* font, int size)
+    {
+        auto it = pages.find(size);
+        if (it != pages.end()) return &it->second;
+
+        const int PAGE_WIDTH = 1024;
+
+        TTF_SetFontSize(font, size);
+
+        FontPage page{};
+        page.lineHeight = TTF_FontHeight(font);
+
+        SDL_Surface* surfaces[GLYPH_COUNT]{};
+        SDL_Color white{ 0xFF, 0xFF, 0xFF, 0xFF };
+        int shelfX = 0, shelfY = 0, shelfH = 0;
+
+        // Lay the glyphs out first so the page is only as tall as it needs to be
+        for (int i = 0; i < GLYPH_COUNT; i++)
+        {
+            Uint16 c = static_cast<Uint16>(GLYPH_FIRST + i);
+
+            int advance = 0;
+            TTF_GlyphMetrics(font, c, NULL, NULL, NULL, NULL, &advance);
+            page.glyphs[i].advance = advance;
+
+            SDL_Surface* glyph = TTF_RenderGlyph_Solid(font, c, white);
+            if (glyph == nullptr) continue;
+
+            surfaces[i] = SDL_ConvertSurfaceFormat(glyph, SDL_PIXELFORMAT_RGBA32, 0);
+            SDL_FreeSurface(glyph);
+            if (surfaces[i] == nullptr) continue;
+
+            int w = surfaces[i]->w, h = surfaces[i]->h;
+            if (shelfX + w + 1 > PAGE_WIDTH)
+            {
+                shelfY += shelfH;
+                shelfX = shelfH = 0;
+            }
+
+            page.glyphs[i].rect = { shelfX, shelfY, w, h };
+            shelfX += w + 1;
+            shelfH = std::max(shelfH, h + 1);
+        }
+
+        page.width = PAGE_WIDTH;
+        page.height = std::max(1, shelfY + shelfH);
+
+        SDL_Surface* pageSurface = SDL_CreateRGBSurfaceWithFormat(0, page.width, page.height, 32, SDL_PIXELFORMAT_RGBA32);
+
+        for (int i = 0; i < GLYPH_COUNT; i++)
+        {
+            if (surfaces[i] == nullptr) continue;
+
+            if (pageSurface != nullptr)
+            {
+                SDL_Rect dest = page.glyphs[i].rect;
+                SDL_SetSurfaceBlendMode(surfaces[i], SDL_BLENDMODE_NONE);
+                SDL_BlitSurface(surfaces[i], NULL, pageSurface, &dest);
+            }
+
+            SDL_FreeSurface(surfaces[i]);
+        }
+
+        if (pageSurface == nullptr)
+        {
+            std::cout << "Failed to create glyph page: " << SDL_GetError() << std::endl;
+            return nullptr;
+        }
+
+        SDL_Texture* texture = SDL_CreateTextureFromSurface(renderer, pageSurface);
+        SDL_FreeSurface(pageSurface);
+
+        if (texture == nullptr)
+        {
+            std::cout << "Failed to create glyph texture: " << SDL_GetError() << std::endl;
+            return nullptr;
+        }
+
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        page.textureId = TextureManager::CreateTexture(texture);
+
+        return &pages.emplace(size, page).first->second;
+    }
+
+    const TextLayout& GlyphCache::GetLayout(const FontPage& page, int size, const char* text, size_t length)
+    {
+        if (layouts.empty()) layouts.resize(LAYOUT_SLOTS);
+
+        // FNV-1a over the size and the characters
+        Uint64 hash = 14695981039346656037ULL ^ static_cast<Uint64>(size);
+        hash *= 1099511628211ULL;
+        for (size_t i = 0; i < length; i++)
+        {
+            hash ^= static_cast<unsigned char>(text[i]);
+            hash *= 1099511628211ULL;
+        }
+
+        TextLayout* slot = nullptr;
+
+        for (size_t p = 0; p < LAYOUT_PROBES; p++)
+        {
+            TextLayout& candidate = layouts[(hash + p) % LAYOUT_SLOTS];
+
+            if (candidate.used && candidate.hash == hash && candidate.size == size && candidate.text.size() == length &&
+                std::memcmp(candidate.text.data(), text, length) == 0)
+            {
+                candidate.lastUsed = frame;
+                return candidate;
+            }
+
+            if (slot == nullptr || (slot->used && (candidate.used == false || candidate.lastUsed < slot->lastUsed))) slot = &candidate;
+        }
+
+        // Reuse the slot's storage, once it has held a string this long it won't allocate again
+        TextLayout& layout = *slot;
+        layout.hash = hash;
+        layout.size = size;
+        layout.text.assign(text, length);
+        layout.src.clear();
+        layout.dest.clear();
+        layout.w = 0;
+        layout.used = true;
+        layout.lastUsed = frame;
+
+        int penX = 0;
+
+        for (size_t i = 0; i < length; i++)
+        {
+            const Glyph& glyph = page.GetGlyph(text[i]);
+
+            if (glyph.rect.w > 0)
+            {
+                layout.src.push_back(glyph.rect);
+                layout.dest.push_back({ penX, 0, glyph.rect.w, glyph.rect.h });
+            }
+
+            penX += glyph.advance;
+            layout.w = std::max(layout.w, penX);
+        }
+
+        layout.h = page.lineHeight;
+
+        return layout;
+    }
+
+    void GlyphCache::EndFrame() { frame++; }
+
+    void GlyphCache::Destroy()
+    {
+        for (auto& page : pages) TextureManager::DestroyTexture(page.second.textureId);
+
+        pages.clear();
+        layouts.clear();
+    }
+
     void GoblRenderer::Close()
     {
+        StopRecording();
+        atlas.Destroy();
+        glyphs.Destroy();
+
         if (sdlRenderer != NULL) SDL_DestroyRenderer(sdlRenderer);
         if (bgTex != NULL)
         {
@@ -241,43 +783,378 @@ namespace gobl
             }
         }
         if (m_window != NULL) SDL_DestroyWindow(m_window);
+        if (headlessSurface != NULL) SDL_FreeSurface(headlessSurface);
+
+        sdlRenderer = NULL;
+        bgTex = NULL;
+        m_window = NULL;
+        headlessSurface = NULL;
 
         TTF_CloseFont(defaultFont);
+        defaultFont = NULL;
     }
 
     void GoblRenderer::PresentBackground()
     {
-        if (shouldUpdateTexture)
+        // Nothing has been drawn into the buffer, so there is nothing to show. Pending
+        // regions are kept so the texture catches up once there is.
+        if (backgroundEnabled == false || backgroundDrawn == false) return;
+
+        for (auto& rect : dirtyRects)
         {
-            SDL_UpdateTexture(bgTex, NULL, m_buffer, WINDOW_WIDTH * sizeof(Uint32)); // Clear the texture
-            shouldUpdateTexture = false;
+            void* pixels = nullptr;
+            int pitch = 0;
+
+            if (SDL_LockTexture(bgTex, &rect, &pixels, &pitch) < 0)
+            {
+                std::cout << "ERROR: " << SDL_GetError() << std::endl;
+                continue;
+            }
+
+            // Only the rows of the changed region move
+            for (int y = 0; y < rect.h; y++)
+            {
+                std::memcpy(static_cast<Uint8*>(pixels) + y * pitch, &m_buffer[(rect.y + y) * WINDOW_WIDTH + rect.x],
+                    rect.w * sizeof(Uint32));
+            }
+
+            SDL_UnlockTexture(bgTex);
         }
 
+        dirtyRects.clear();
+
         SDL_RenderCopy(sdlRenderer, bgTex, NULL, NULL); // Move the texture to the renderer
     }
 
     void GoblRenderer::Present()
     {
-        RenderSurfaces();
-        DrawStrings();
+        if (recording != NULL) RecordFrame();
+
+        {
+            AllocationScope scope(pendingAllocations);
+
+            {
+                ProfileScope render(PROFILE_RENDER);
+                RenderSurfaces();
+                DrawFills();
+            }
+            {
+                ProfileScope text(PROFILE_TEXT);
+                DrawStrings();
+                glyphs.EndFrame();
+            }
+        }
+
+        drawCalls = pendingDrawCalls;
+        submittedObjects = pendingObjects;
+        renderAllocations = pendingAllocations;
+        pendingDrawCalls = pendingObjects = 0;
+        pendingAllocations = 0;
+
+        if (headless.enabled)
+        {
+            if (std::find(headless.captureFrames.begin(), headless.captureFrames.end(), frameIndex) != headless.captureFrames.end())
+            {
+                std::string number = std::to_string(frameIndex);
+                number.insert(0, number.size() < 6 ? 6 - number.size() : 0, '0');
 
+                CaptureFrame((std::filesystem::path(headless.captureDirectory) / ("frame_" + number + ".png")).string());
+            }
+
+            // Leave through the normal quit path so the game shuts down as it would from the window
+            if (headless.frameLimit > 0 && frameIndex + 1 == headless.frameLimit)
+            {
+                SDL_Event quit{};
+                quit.type = SDL_QUIT;
+                SDL_PushEvent(&quit);
+            }
+        }
+
+        frameIndex++;
+
+        ProfileScope present(PROFILE_PRESENT);
         SDL_RenderPresent(sdlRenderer); // Show the renderer
     }
 
+    void FramePacer::Configure(const PacingSettings& pacing, SDL_Renderer* sdlRenderer, bool vsyncEnabled)
+    {
+        settings = pacing;
+        if (settings.targetFps == 0) settings.targetFps = 60;
+        if (settings.idleFps == 0) settings.idleFps = 1;
+
+        renderer = sdlRenderer;
+        vsync = vsyncEnabled;
+        frequency = static_cast<double>(SDL_GetPerformanceFrequency());
+        frameStart = SDL_GetPerformanceCounter();
+        misses = hits = 0;
+    }
+
+    void FramePacer::WaitUntil(Uint64 deadline, bool wakeOnInput)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+        if (now >= deadline) return;
+
+        double remaining = (deadline - now) / frequency;
+
+        if (wakeOnInput)
+        {
+            // Idle frames are long, any event cuts the wait short so input still feels immediate
+            SDL_WaitEventTimeout(NULL, static_cast<int>(remaining * 1000.0));
+            return;
+        }
+
+        if (remaining > SPIN_SECONDS) SDL_Delay(static_cast<Uint32>((remaining - SPIN_SECONDS) * 1000.0));
+        while (SDL_GetPerformanceCounter() < deadline) {}
+    }
+
+    void FramePacer::EndFrame(bool idle)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+        double frameSeconds = (now - frameStart) / frequency;
+        double targetSeconds = 1.0 / settings.targetFps;
+
+        if (idle)
+        {
+            WaitUntil(frameStart + static_cast<Uint64>(frequency / settings.idleFps), true);
+        }
+        else if (settings.mode == PACING_CAPPED)
+        {
+            WaitUntil(frameStart + static_cast<Uint64>(targetSeconds * frequency), false);
+        }
+        else if (settings.mode == PACING_ADAPTIVE && renderer != nullptr)
+        {
+            if (vsync)
+            {
+                // Late frames wait a whole extra refresh under vsync, after a run of them tear instead
+                misses = frameSeconds > targetSeconds * 1.5 ? misses + 1 : 0;
+                if (misses >= ADAPTIVE_MISSES && SDL_RenderSetVSync(renderer, 0) == 0)
+                {
+                    vsync = false;
+                    misses = hits = 0;
+                }
+            }
+            else
+            {
+                hits = frameSeconds < targetSeconds * 0.8 ? hits + 1 : 0;
+                if (hits >= ADAPTIVE_RECOVER && SDL_RenderSetVSync(renderer, 1) == 0)
+                {
+                    vsync = true;
+                    misses = hits = 0;
+                }
+                else WaitUntil(frameStart + static_cast<Uint64>(targetSeconds * frequency), false);
+            }
+        }
+
+        frameStart = SDL_GetPerformanceCounter();
+    }
+
+    void GoblRenderer::DrawFills()
+    {
+        if (fills.empty()) return;
+
+        SDL_SetRenderDrawBlendMode(sdlRenderer, SDL_BLENDMODE_BLEND);
+
+        if (useGeometry)
+        {
+            vertices.clear();
+            indices.clear();
+
+            for (auto& fill : fills) PushQuad(fill.rect, { 0, 0, 1, 1 }, 1, 1, fill.color);
+
+            if (SDL_RenderGeometry(sdlRenderer, NULL, vertices.data(), static_cast<int>(vertices.size()),
+                indices.data(), static_cast<int>(indices.size())) == 0) pendingDrawCalls++;
+            else std::cout << "ERROR: " << SDL_GetError() << std::endl;
+        }
+        else
+        {
+            for (auto& fill : fills)
+            {
+                SDL_SetRenderDrawColor(sdlRenderer, fill.color.r, fill.color.g, fill.color.b, fill.color.a);
+                SDL_RenderFillRect(sdlRenderer, &fill.rect);
+                pendingDrawCalls++;
+            }
+
+            SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 0xFF);
+        }
+
+        SDL_SetRenderDrawBlendMode(sdlRenderer, SDL_BLENDMODE_NONE);
+        fills.clear();
+    }
+
+    bool GoblRenderer::CaptureFrame(const std::string& path)
+    {
+        SDL_Surface* capture = SDL_CreateRGBSurfaceWithFormat(0, WINDOW_WIDTH, WINDOW_HEIGHT, 32, SDL_PIXELFORMAT_RGBA32);
+        if (capture == NULL)
+        {
+            std::cout << "ERROR: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        bool saved = false;
+
+        if (SDL_RenderReadPixels(sdlRenderer, NULL, SDL_PIXELFORMAT_RGBA32, capture->pixels, capture->pitch) < 0)
+            std::cout << "ERROR: " << SDL_GetError() << std::endl;
+        else
+        {
+            std::filesystem::path parent = std::filesystem::path(path).parent_path();
+            std::error_code error;
+            if (parent.empty() == false) std::filesystem::create_directories(parent, error);
+
+            saved = IMG_SavePNG(capture, path.c_str()) == 0;
+            if (saved == false) std::cout << "Unable to save frame: " << path << " - " << IMG_GetError() << std::endl;
+        }
+
+        SDL_FreeSurface(capture);
+
+        return saved;
+    }
+
     void GoblRenderer::SetPixel(int x, int y, Uint8 r, Uint8 g, Uint8 b)
     {
         if (x < 0 || x >= WINDOW_WIDTH || y < 0 || y >= WINDOW_HEIGHT)  return;
 
         m_buffer[(y * WINDOW_WIDTH) + x] = ColorFromRGB(r, g, b);
 
-        shouldUpdateTexture = true;
+        backgroundDrawn = true;
+        MarkDirty({ x, y, 1, 1 });
     }
 
     void GoblRenderer::ClearScreen(Color c)
     {
-        for (int i = 0; i < WINDOW_WIDTH * WINDOW_HEIGHT; i++) m_buffer[i] = ColorFromRGB(c.r, c.g, c.b, c.a);
+        GetRasterKernels().fill(m_buffer, WINDOW_WIDTH * WINDOW_HEIGHT, ColorFromRGB(c.r, c.g, c.b, c.a));
+
+        // A fully transparent clear leaves nothing worth presenting
+        backgroundDrawn = c != Color{ 0, 0, 0, 0 };
+        MarkDirty({ 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT });
+    }
+
+    void GoblRenderer::FillSpan(int x, int y, int length, Color c)
+    {
+        FillRect({ x, y, length, 1 }, c);
+    }
+
+    void GoblRenderer::FillRect(SDL_Rect rect, Color c)
+    {
+        SDL_Rect screen{ 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+        if (SDL_IntersectRect(&rect, &screen, &rect) == SDL_FALSE) return;
+
+        const RasterKernels& kernels = GetRasterKernels();
+        Uint32 color = ColorFromRGB(c.r, c.g, c.b, c.a);
+
+        for (int y = rect.y; y < rect.y + rect.h; y++) kernels.fill(&m_buffer[y * WINDOW_WIDTH + rect.x], rect.w, color);
+
+        backgroundDrawn = true;
+        MarkDirty(rect);
+    }
+
+    void GoblRenderer::DrawLine(IntVec2 a, IntVec2 b, Color c)
+    {
+        // Straight rows are a single span
+        if (a.y == b.y)
+        {
+            FillSpan(std::min(a.x, b.x), a.y, abs(b.x - a.x) + 1, c);
+            return;
+        }
+
+        Uint32 color = ColorFromRGB(c.r, c.g, c.b, c.a);
+        int dx = abs(b.x - a.x), sx = a.x < b.x ? 1 : -1;
+        int dy = -abs(b.y - a.y), sy = a.y < b.y ? 1 : -1;
+        int err = dx + dy;
+        int x = a.x, y = a.y;
+
+        while (true)
+        {
+            if (x >= 0 && x < WINDOW_WIDTH && y >= 0 && y < WINDOW_HEIGHT) m_buffer[y * WINDOW_WIDTH + x] = color;
+            if (x == b.x && y == b.y) break;
+
+            int e2 = 2 * err;
+            if (e2 >= dy) { err += dy; x += sx; }
+            if (e2 <= dx) { err += dx; y += sy; }
+        }
+
+        backgroundDrawn = true;
+        MarkDirty({ std::min(a.x, b.x), std::min(a.y, b.y), dx + 1, 1 - dy });
+    }
+
+    void GoblRenderer::BlitSurface(SDL_Surface* surface, int x, int y, Color tint)
+    {
+        if (surface == nullptr) return;
+
+        SDL_Rect dest{ x, y, surface->w, surface->h };
+        SDL_Rect screen{ 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+        if (SDL_IntersectRect(&dest, &screen, &dest) == SDL_FALSE) return;
+
+        // The kernels work on the buffer's own format
+        SDL_Surface* converted = nullptr;
+        if (surface->format->format != SDL_PIXELFORMAT_RGBA8888)
+        {
+            converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA8888, 0);
+            if (converted == nullptr)
+            {
+                std::cout << "ERROR: Unable to convert surface: " << SDL_GetError() << std::endl;
+                return;
+            }
+
+            surface = converted;
+        }
+
+        const RasterKernels& kernels = GetRasterKernels();
+        Uint32 tintColor = ColorFromRGB(tint.r, tint.g, tint.b, tint.a);
+        bool tinted = tint != Color::WHITE;
+
+        SDL_LockSurface(surface);
+
+        for (int row = 0; row < dest.h; row++)
+        {
+            const Uint32* src = reinterpret_cast<const Uint32*>(static_cast<const Uint8*>(surface->pixels) +
+                (dest.y - y + row) * surface->pitch) + (dest.x - x);
+            Uint32* dst = &m_buffer[(dest.y + row) * WINDOW_WIDTH + dest.x];
+
+            if (tinted) kernels.tintBlend(dst, src, dest.w, tintColor);
+            else kernels.blend(dst, src, dest.w);
+        }
+
+        SDL_UnlockSurface(surface);
+        if (converted != nullptr) SDL_FreeSurface(converted);
+
+        backgroundDrawn = true;
+        MarkDirty(dest);
+    }
+
+    void GoblRenderer::MarkDirty(SDL_Rect rect)
+    {
+        SDL_Rect screen{ 0, 0, WINDOW_WIDTH, WINDOW_HEIGHT };
+        if (SDL_IntersectRect(&rect, &screen, &rect) == SDL_FALSE) return;
+
+        // Fold the rect into any it overlaps or touches, repeating as the merged rect grows
+        bool merged = true;
+        while (merged)
+        {
+            merged = false;
 
-        shouldUpdateTexture = true;
+            for (size_t i = 0; i < dirtyRects.size(); i++)
+            {
+                SDL_Rect grown{ dirtyRects[i].x - 1, dirtyRects[i].y - 1, dirtyRects[i].w + 2, dirtyRects[i].h + 2 };
+                if (SDL_HasIntersection(&grown, &rect) == SDL_FALSE) continue;
+
+                SDL_UnionRect(&dirtyRects[i], &rect, &rect);
+                dirtyRects.erase(dirtyRects.begin() + i);
+                merged = true;
+                break;
+            }
+        }
+
+        dirtyRects.push_back(rect);
+
+        // Too many scattered regions cost more in locks than they save, upload their bounds instead
+        if (dirtyRects.size() > MAX_DIRTY_RECTS)
+        {
+            SDL_Rect bounds = dirtyRects[0];
+            for (auto& r : dirtyRects) SDL_UnionRect(&bounds, &r, &bounds);
+
+            dirtyRects.clear();
+            dirtyRects.push_back(bounds);
+        }
     }
 
     SDL_Texture* GoblRenderer::LoadTexture(const char* path, SDL_Rect& rect, SDL_Rect& sprRect)
@@ -315,108 +1192,395 @@ namespace gobl
 
     void GoblRenderer::QueueTexture(SDL_Texture* texture, SDL_Rect& rect, SDL_Rect& sprRect)
     {
-        renderObjects.push_back({texture, rect, sprRect});
+        QueueCommand(RenderObject{ texture, rect, sprRect });
     }
-    void GoblRenderer::QueueTexture(RenderObject ro) { renderObjects.push_back(ro); }
 
-    void GoblRenderer::QueueString(std::string text, int size, int x, int y, Uint8 r, Uint8 g, Uint8 b)
+    void GoblRenderer::QueueCommand(const RenderCommand& command)
+    {
+        AllocationScope scope(pendingAllocations);
+        commands.push_back(command);
+    }
+
+    void GoblRenderer::DrawSprite(const SpriteHandle& sprite, int frame, IntVec2 pos, float scale, Color tint, bool flip, bool cameraRelative,
+        Sint16 layer)
+    {
+        if (sprite.textureId == -1) return;
+
+        RenderCommand command{};
+        command.textureId = sprite.textureId;
+        command.rect = { pos.x, pos.y, static_cast<int>(sprite.frameW * scale), static_cast<int>(sprite.frameH * scale) };
+        command.srcX = static_cast<Sint16>(sprite.originX + sprite.frameW * frame);
+        command.srcY = sprite.originY;
+        command.srcW = sprite.frameW;
+        command.srcH = sprite.frameH;
+        command.color = tint;
+        command.layer = layer;
+        command.flags = RENDER_PADDED | (flip ? RENDER_FLIPPED : 0) | (cameraRelative ? RENDER_CAMERA : 0);
+
+        QueueCommand(command);
+    }
+
+    int GoblRenderer::CreateRenderTarget(int w, int h)
+    {
+        SDL_Texture* texture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, w, h);
+        if (texture == nullptr)
+        {
+            std::cout << "Unable to create render target: " << SDL_GetError() << std::endl;
+            return -1;
+        }
+
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+
+        return TextureManager::CreateTexture(texture);
+    }
+
+    int GoblRenderer::CreateBlankTexture(int w, int h)
+    {
+        SDL_Texture* texture = SDL_CreateTexture(sdlRenderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC, w, h);
+        if (texture == nullptr)
+        {
+            std::cout << "Unable to create texture: " << SDL_GetError() << std::endl;
+            return -1;
+        }
+
+        SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+        SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+
+        return TextureManager::CreateTexture(texture);
+    }
+
+    void GoblRenderer::BeginTarget(int textureId, float scale)
+    {
+        // Anything queued from here until EndTarget is drawn into the target instead of the screen
+        std::swap(commands, stashedCommands);
+        targetId = textureId;
+        targetScale = scale;
+    }
+
+    void GoblRenderer::EndTarget()
+    {
+        AllocationScope scope(pendingAllocations);
+
+        if (targetId != -1 && SDL_SetRenderTarget(sdlRenderer, TextureManager::GetTexture(targetId)) == 0)
+        {
+            SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 0);
+            SDL_RenderClear(sdlRenderer);
+
+            if (targetScale != 1.0f) SDL_RenderSetScale(sdlRenderer, targetScale, targetScale);
+            RenderSurfaces();
+            if (targetScale != 1.0f) SDL_RenderSetScale(sdlRenderer, 1.0f, 1.0f);
+
+            SDL_SetRenderTarget(sdlRenderer, NULL);
+            SDL_SetRenderDrawColor(sdlRenderer, 0, 0, 0, 0xFF);
+        }
+        else
+        {
+            std::cout << "ERROR: Unable to draw to render target: " << SDL_GetError() << std::endl;
+            commands.clear();
+        }
+
+        std::swap(commands, stashedCommands);
+        targetId = -1;
+        targetScale = 1.0f;
+    }
+
+    bool GoblRenderer::BlurTarget(int sourceId, int outputId, int radius, int passes)
+    {
+        SDL_Texture* source = TextureManager::GetTexture(sourceId);
+        int w = 0, h = 0;
+        if (source == nullptr || SDL_QueryTexture(source, NULL, NULL, &w, &h) < 0) return false;
+
+        blurPixels.resize(static_cast<size_t>(w) * h);
+        blurScratch.resize(blurPixels.size());
+
+        // Small targets only, a read back stalls until the GPU has caught up
+        bool read = SDL_SetRenderTarget(sdlRenderer, source) == 0 &&
+            SDL_RenderReadPixels(sdlRenderer, NULL, SDL_PIXELFORMAT_RGBA8888, blurPixels.data(), w * sizeof(Uint32)) == 0;
+        SDL_SetRenderTarget(sdlRenderer, NULL);
+
+        if (read == false)
+        {
+            std::cout << "ERROR: Unable to read render target: " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        BoxBlur(blurPixels.data(), blurScratch.data(), w, h, radius, passes);
+
+        return SDL_UpdateTexture(TextureManager::GetTexture(outputId), NULL, blurPixels.data(), w * sizeof(Uint32)) == 0;
+    }
+
+    void GoblRenderer::QueueString(const std::string& text, int size, int x, int y, Uint8 r, Uint8 g, Uint8 b)
     { 
-        strings.push_back({ text, size, x, y, r, g, b }); 
+        QueueString(RenderText{ text, x, y, size, r, g, b });
     }
-    void GoblRenderer::QueueString(RenderText t) 
+    void GoblRenderer::QueueString(const RenderText& t) 
     { 
-        strings.push_back(t); 
+        AllocationScope scope(pendingAllocations);
+
+        TextCommand command{};
+        command.offset = static_cast<Uint32>(textArena.size());
+        command.length = static_cast<Uint32>(t.text.size());
+        command.size = t.size;
+        command.x = t.x;
+        command.y = t.y;
+        command.r = t.r;
+        command.g = t.g;
+        command.b = t.b;
+        command.outline = t.outline;
+
+        textArena.insert(textArena.end(), t.text.begin(), t.text.end());
+        strings.push_back(command);
+    }
+
+    IntVec2 GoblRenderer::MeasureString(const std::string& text, int size)
+    {
+        FontPage* page = glyphs.GetPage(sdlRenderer, defaultFont, size);
+        if (page == nullptr) return { 0, 0 };
+
+        const TextLayout& layout = glyphs.GetLayout(*page, size, text.c_str(), text.size());
+        return { layout.w, layout.h };
     }
 
     void GoblRenderer::DrawStrings()
     {
-        for (auto str : strings)
+        int lastTexture = -1;
+        SDL_Texture* texture = nullptr;
+        int texW = 0, texH = 0;
+
+        vertices.clear();
+        indices.clear();
+
+        for (auto& str : strings)
         {
-            if (str.text.length() < 1) continue;
+            if (str.length < 1) continue;
 
-            TTF_SetFontSize(defaultFont, str.size);
+            FontPage* page = glyphs.GetPage(sdlRenderer, defaultFont, str.size);
+            if (page == nullptr) continue;
 
-            SDL_Color col = { str.r, str.g, str.b, 0xFF };
-            SDL_Surface* textSurface = TTF_RenderText_Solid(defaultFont, str.text.c_str(), col);
-            if (!textSurface)
+            // Strings of the same size share a page, only break the batch when the size changes
+            if (page->textureId != lastTexture)
             {
-                std::cout << "Failed to render text: " << TTF_GetError() << std::endl;
-                return;
+                if (texture != nullptr) SubmitGeometry(texture);
+
+                lastTexture = page->textureId;
+                texture = TextureManager::GetTexture(lastTexture);
+                texW = page->width;
+                texH = page->height;
             }
 
-            SDL_Texture* text_texture = SDL_CreateTextureFromSurface(sdlRenderer, textSurface);
-            SDL_Rect dest = { str.x, str.y, textSurface->w, textSurface->h };
+            const TextLayout& layout = glyphs.GetLayout(*page, str.size, &textArena[str.offset], str.length);
 
             if (str.outline > 0)
             {
-                SDL_SetTextureColorMod(text_texture, 0, 0, 0);
-
-                dest.x -= str.outline / 2;
-                dest.y -= str.outline / 2;
+                SDL_Color black{ 0, 0, 0, 0xFF };
+                int offX = str.x - str.outline / 2;
+                int offY = str.y - str.outline / 2;
 
                 for (Uint16 i = 0; i < str.outline; i++)
                 {
-                    dest.x += i;
-                    dest.y += i;
+                    offX += i;
+                    offY += i;
 
-                    SDL_RenderCopy(sdlRenderer, text_texture, NULL, &dest);
-                }
+                    for (size_t g = 0; g < layout.src.size(); g++)
+                    {
+                        SDL_Rect dest = layout.dest[g];
+                        dest.x += offX;
+                        dest.y += offY;
 
-                dest = { str.x, str.y, textSurface->w, textSurface->h };
-                SDL_SetTextureColorMod(text_texture, str.r, str.g, str.b);
+                        PushQuad(dest, layout.src[g], texW, texH, black);
+                    }
+                }
             }
 
-            SDL_RenderCopy(sdlRenderer, text_texture, NULL, &dest);
+            SDL_Color col{ str.r, str.g, str.b, 0xFF };
+            for (size_t g = 0; g < layout.src.size(); g++)
+            {
+                SDL_Rect dest = layout.dest[g];
+                dest.x += str.x;
+                dest.y += str.y;
 
-            SDL_DestroyTexture(text_texture);
-            SDL_FreeSurface(textSurface);
+                PushQuad(dest, layout.src[g], texW, texH, col);
+            }
         }
 
+        if (texture != nullptr) SubmitGeometry(texture);
+
         strings.clear();
+        textArena.clear();
     }
 
-    void GoblRenderer::RenderSurfaces()
+    void GoblRenderer::PushQuad(const SDL_Rect& dest, const SDL_Rect& src, int texW, int texH, SDL_Color c, bool flipped)
+    {
+        float x0 = static_cast<float>(dest.x);
+        float y0 = static_cast<float>(dest.y);
+        float x1 = x0 + dest.w;
+        float y1 = y0 + dest.h;
+
+        SDL_FPoint corners[4] = { { x0, y0 }, { x1, y0 }, { x1, y1 }, { x0, y1 } };
+        PushQuad(corners, src, texW, texH, c, flipped);
+    }
+
+    void GoblRenderer::PushQuad(const SDL_FPoint corners[4], const SDL_Rect& src, int texW, int texH, SDL_Color c, bool flipped)
+    {
+        float u0 = src.x / static_cast<float>(texW);
+        float v0 = src.y / static_cast<float>(texH);
+        float u1 = (src.x + src.w) / static_cast<float>(texW);
+        float v1 = (src.y + src.h) / static_cast<float>(texH);
+        if (flipped) std::swap(u0, u1);
+
+        int v = static_cast<int>(vertices.size());
+
+        vertices.push_back({ corners[0], c, { u0, v0 } });
+        vertices.push_back({ corners[1], c, { u1, v0 } });
+        vertices.push_back({ corners[2], c, { u1, v1 } });
+        vertices.push_back({ corners[3], c, { u0, v1 } });
+
+        indices.push_back(v);
+        indices.push_back(v + 1);
+        indices.push_back(v + 2);
+        indices.push_back(v);
+        indices.push_back(v + 2);
+        indices.push_back(v + 3);
+    }
+
+    void GoblRenderer::SubmitGeometry(SDL_Texture* texture)
     {
-        int lastT = -1;
-        Color lastC{ 0xFF, 0xFF, 0xFF, 0xFF };
+        if (vertices.empty()) return;
+
+        // Tinting is carried by the vertices, make sure an old color mod isn't multiplied in
+        SDL_SetTextureColorMod(texture, 0xFF, 0xFF, 0xFF);
+        SDL_SetTextureAlphaMod(texture, 0xFF);
 
-        for (size_t i = 0; i < renderObjects.size(); i++)
+        if (useGeometry && SDL_RenderGeometry(sdlRenderer, texture, vertices.data(), static_cast<int>(vertices.size()),
+            indices.data(), static_cast<int>(indices.size())) == 0)
+        {
+            pendingDrawCalls++;
+        }
+        else
         {
-            auto r = renderObjects.at(i).rect;
-            r.w += 1;
-            r.h += 1;
-            r.x -= 1;
-            r.y -= 1;
+            if (useGeometry) std::cout << "ERROR: Geometry rendering unavailable, falling back to copies. " << SDL_GetError() << std::endl;
+            useGeometry = false;
 
-            Color c = renderObjects.at(i).color;
-            SDL_Texture* texture = TextureManager::GetTexture(renderObjects.at(i).textureId);
+            int texW = 0, texH = 0;
+            SDL_QueryTexture(texture, NULL, NULL, &texW, &texH);
 
-            if (c != lastC || lastT != renderObjects.at(i).textureId)
+            // Rebuild each quad as a copy, every vertex of a quad shares one color
+            for (size_t v = 0; v + 3 < vertices.size(); v += 4)
             {
-                SDL_SetTextureColorMod(texture, c.r, c.g, c.b);
-                SDL_SetTextureAlphaMod(texture, c.a);
+                const SDL_Vertex& a = vertices[v];
+                const SDL_Vertex& b = vertices[v + 1];
+                const SDL_Vertex& c = vertices[v + 2];
+                const SDL_Vertex& d = vertices[v + 3];
+
+                bool flipped = a.tex_coord.x > c.tex_coord.x;
+                float u0 = flipped ? c.tex_coord.x : a.tex_coord.x;
+                float u1 = flipped ? a.tex_coord.x : c.tex_coord.x;
+
+                SDL_Rect src{ static_cast<int>(u0 * texW + 0.5f), static_cast<int>(a.tex_coord.y * texH + 0.5f),
+                    static_cast<int>((u1 - u0) * texW + 0.5f), static_cast<int>((c.tex_coord.y - a.tex_coord.y) * texH + 0.5f) };
+
+                // The quad may be rotated, recover its size and angle from its edges
+                float w = std::hypot(b.position.x - a.position.x, b.position.y - a.position.y);
+                float h = std::hypot(d.position.x - a.position.x, d.position.y - a.position.y);
+                double angle = std::atan2(b.position.y - a.position.y, b.position.x - a.position.x) * 57.2957795;
+                float midX = (a.position.x + c.position.x) / 2.0f;
+                float midY = (a.position.y + c.position.y) / 2.0f;
+                SDL_FRect dest{ midX - w / 2.0f, midY - h / 2.0f, w, h };
 
-                lastC = c;
-                lastT = renderObjects.at(i).textureId;
+                SDL_SetTextureColorMod(texture, a.color.r, a.color.g, a.color.b);
+                SDL_SetTextureAlphaMod(texture, a.color.a);
+
+                if (SDL_RenderCopyExF(sdlRenderer, texture, &src, &dest, angle, NULL, flipped ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE) < 0)
+                    std::cout << "ERROR: " << SDL_GetError() << std::endl;
+
+                pendingDrawCalls++;
             }
+        }
 
-            // Move the texture to the renderer
-            if (SDL_RenderCopyEx(sdlRenderer, texture, &renderObjects.at(i).sprRect, &r, 0.0, NULL, renderObjects.at(i).GetFlipped()) < 0)
-                std::cout << "ERROR: " << SDL_GetError() << std::endl;
+        vertices.clear();
+        indices.clear();
+    }
+
+    void GoblRenderer::SubmitBatch(size_t start, size_t end)
+    {
+        SDL_Texture* texture = TextureManager::GetTexture(commands[renderOrder[start] & 0xFFFFFF].textureId);
+
+        int texW = 0, texH = 0;
+        SDL_QueryTexture(texture, NULL, NULL, &texW, &texH);
+        if (texW <= 0 || texH <= 0) return;
+
+        vertices.clear();
+        indices.clear();
+
+        for (size_t i = start; i < end; i++)
+        {
+            const RenderCommand& c = commands[renderOrder[i] & 0xFFFFFF];
+            SDL_Rect r = c.rect;
+            if (c.flags & RENDER_PADDED) r = { c.rect.x - 1, c.rect.y - 1, c.rect.w + 1, c.rect.h + 1 };
+
+            SDL_Color color{ c.color.r, c.color.g, c.color.b, c.color.a };
+
+            if (c.flags & RENDER_CAMERA)
+            {
+                float x0 = static_cast<float>(r.x), y0 = static_cast<float>(r.y);
+                float x1 = x0 + r.w, y1 = y0 + r.h;
+
+                SDL_FPoint corners[4] = { view.Apply(x0, y0), view.Apply(x1, y0), view.Apply(x1, y1), view.Apply(x0, y1) };
+                PushQuad(corners, c.GetSrc(), texW, texH, color, (c.flags & RENDER_FLIPPED) != 0);
+            }
+            else PushQuad(r, c.GetSrc(), texW, texH, color, (c.flags & RENDER_FLIPPED) != 0);
+        }
+
+        SubmitGeometry(texture);
+    }
+
+    void GoblRenderer::SortCommands()
+    {
+        // Layers keep their order, inside a layer group by texture then blend so runs can share one call.
+        // Each key is layer | texture | blend | queue index, the index keeps equal keys in queue order.
+        renderOrder.clear();
+
+        for (size_t i = 0; i < commands.size() && i <= 0xFFFFFF; i++)
+        {
+            const RenderCommand& c = commands[i];
+
+            renderOrder.push_back((static_cast<Uint64>(static_cast<Uint16>(c.layer + 0x8000)) << 48) |
+                (static_cast<Uint64>(c.textureId & 0xFFFFF) << 28) | (static_cast<Uint64>(c.blend & 0xF) << 24) | i);
         }
 
-        renderObjects.clear();
+        std::sort(renderOrder.begin(), renderOrder.end());
+    }
+
+    void GoblRenderer::RenderSurfaces()
+    {
+        pendingObjects += static_cast<Uint32>(commands.size());
+
+        if (camera != nullptr) view = camera->GetTransform();
+        SortCommands();
+
+        size_t start = 0;
+        while (start < renderOrder.size())
+        {
+            // Texture and blend bits, runs can carry on across layers when they match
+            Uint64 run = (renderOrder[start] >> 24) & 0xFFFFFF;
+
+            size_t end = start + 1;
+            while (end < renderOrder.size() && ((renderOrder[end] >> 24) & 0xFFFFFF) == run) end++;
+
+            const RenderCommand& first = commands[renderOrder[start] & 0xFFFFFF];
+            SDL_SetTextureBlendMode(TextureManager::GetTexture(first.textureId), static_cast<SDL_BlendMode>(first.blend));
+            SubmitBatch(start, end);
+
+            start = end;
+        }
+
+        commands.clear();
     }
 }
 
 // Sprite
 namespace gobl 
 {
-    void TranslateRect(Camera* cam, RenderObject& ro)
-    {
-        ro.rect = cam->GetRect(ro.rect);
-    }
-
     Sprite* Sprite::Draw()
     {
         if (GetTextureExists() == false) CriticalError("ERROR: Cannot render a NULL texture.");
@@ -430,9 +1594,12 @@ namespace gobl
         if (GetTextureExists() == false) CriticalError("ERROR: Cannot render a NULL texture.");
         else
         {
-            RenderObject ro = RenderObject(renderObject);
-            TranslateRect(cam, ro); // FIXME: This is a bandaid to a greater problem.
-            renderer->QueueTexture(ro);
+            // The renderer applies the camera when it builds the frame
+            RenderCommand command(renderObject);
+            command.flags |= RENDER_CAMERA;
+
+            if (renderer->GetCamera() != cam) renderer->SetCamera(cam);
+            renderer->QueueCommand(command);
         }
 
         return this;
@@ -440,12 +1607,12 @@ namespace gobl
 
     Sprite* Sprite::SetSpriteIndex(int x, int y)
     {
-        renderObject.sprRect.x = renderObject.sprRect.w * x;
-        renderObject.sprRect.y = renderObject.sprRect.h * y;
+        renderObject.sprRect.x = origin.x + renderObject.sprRect.w * x;
+        renderObject.sprRect.y = origin.y + renderObject.sprRect.h * y;
 
         return this;
     }
-    int Sprite::GetSpriteIndex() { return (renderObject.sprRect.x / renderObject.sprRect.w); }
+    int Sprite::GetSpriteIndex() { return ((renderObject.sprRect.x - origin.x) / renderObject.sprRect.w); }
 
     Sprite* Sprite::ResetDimensions()
     {
@@ -528,8 +1695,31 @@ namespace gobl
 
     void Sprite::LoadTexture(const char* path)
     {
-        std::cout << "Loading texture... " << path << std::endl;
-        renderObject.textureId = TextureManager::CreateTexture(renderer->LoadTexture(path, renderObject.rect, renderObject.sprRect));
+        AtlasRegion region{};
+
+        // Drop whatever this sprite held before
+        TextureManager::Release(texture);
+        texture = {};
+
+        if (renderer->GetAtlasRegion(path, region))
+        {
+            renderObject.textureId = region.textureId;
+            renderObject.sprRect = region.rect;
+            renderObject.rect = { 0, 0, region.rect.w, region.rect.h };
+            origin = { region.rect.x, region.rect.y };
+        }
+        else
+        {
+            texture = TextureManager::Load(renderer->GetRenderer(), path);
+            renderObject.textureId = texture.id;
+
+            int w = 0, h = 0;
+            if (texture.id != -1) SDL_QueryTexture(TextureManager::GetTexture(texture), NULL, NULL, &w, &h);
+
+            renderObject.rect = { 0, 0, w, h };
+            renderObject.sprRect = { 0, 0, w, h };
+            origin = { 0, 0 };
+        }
 
         staticDim.x = renderObject.sprRect.w;
         staticDim.y = renderObject.sprRect.h;
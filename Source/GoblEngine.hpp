@@ -9,7 +9,15 @@
 #include <vector>
 #include <unordered_map>
 #include <string>
+#include <cmath>
+#include <algorithm>
 #include <SDL_mixer.h>
+#include "Profiler.hpp"
+#include "AssetLoader.hpp"
+
+#if defined(_DEBUG) && !defined(GOBL_COUNT_ALLOCATIONS)
+#define GOBL_COUNT_ALLOCATIONS
+#endif
 
 inline float lerp(float a, float b, float f) { return (a * (1.0f - f)) + (b * f); }
 
@@ -156,8 +164,13 @@ struct Clock
 private:
     static Clock* instance;
 
-    uint32_t last_tick_time = 0;
-    uint32_t delta = 0;
+    // Longest frame the simulation will catch up on, anything past it is dropped instead of
+    // running a burst of ticks after a stall
+    const double MAX_DELTA = 0.25;
+    const Uint32 MAX_STEPS = 8;
+
+    Uint64 lastCounter = 0;
+    double frequency = 1.0;
 
     Uint32 fps = 30;
     Uint32 frames = 0;
@@ -165,21 +178,34 @@ private:
 
     double frameTime = 0.0;
 
+    // Fixed timestep simulation
+    double fixedStep = 1.0 / 60.0;
+    double accumulator = 0.0;
+    Uint32 stepsThisFrame = 0;
+    long long totalSteps = 0;
+
 public:
-    Clock() { instance = this; }
+    Clock()
+    {
+        instance = this;
+        frequency = static_cast<double>(SDL_GetPerformanceFrequency());
+        lastCounter = SDL_GetPerformanceCounter();
+    }
 
     double deltaTime = 0.0;
     float fDeltaTime = 0.0;
 
     void Tick()
     {
-        uint32_t tick_time = SDL_GetTicks();
-        delta = tick_time - last_tick_time;
+        Uint64 counter = SDL_GetPerformanceCounter();
 
-        deltaTime = delta / 1000.0;
+        deltaTime = (counter - lastCounter) / frequency;
         fDeltaTime = static_cast<float>(deltaTime);
 
-        last_tick_time = tick_time;
+        lastCounter = counter;
+
+        accumulator += std::min(deltaTime, MAX_DELTA);
+        stepsThisFrame = 0;
 
         totalFrames++;
         frames++;
@@ -192,9 +218,34 @@ public:
         }
     }
 
+    // Call until it returns false, once per simulation tick owed since the last frame
+    bool StepSimulation()
+    {
+        if (accumulator < fixedStep) return false;
+
+        if (stepsThisFrame >= MAX_STEPS)
+        {
+            accumulator = std::fmod(accumulator, fixedStep);
+            return false;
+        }
+
+        accumulator -= fixedStep;
+        stepsThisFrame++;
+        totalSteps++;
+
+        return true;
+    }
+
+    void SetTickRate(Uint32 ticksPerSecond) { fixedStep = 1.0 / std::max(1U, ticksPerSecond); }
+
     Uint32 GetFps() { return fps; }
     long long GetFrames() { return totalFrames; }
+    long long GetSteps() { return totalSteps; }
+    // How far between the last simulation tick and the next one this frame is, 0 to 1
+    float GetAlpha() { return static_cast<float>(accumulator / fixedStep); }
     static float GetDeltaTime() { return instance->fDeltaTime; }
+    static float GetFixedDelta() { return static_cast<float>(instance->fixedStep); }
+    static float GetInterpolation() { return instance->GetAlpha(); }
 };
 
 enum KeyState : Uint8
@@ -293,41 +344,181 @@ namespace gobl
 // Renderer
 namespace gobl
 {
+    // A reference to a texture slot, stale once the slot has been freed and reused
+    struct TextureHandle
+    {
+        int id = -1;
+        Uint32 generation = 0;
+    };
+
     class TextureManager
     {
     private:
-        static std::vector<SDL_Texture*> textures;
+        struct TextureSlot
+        {
+            SDL_Texture* texture = nullptr;
+            Uint32 generation = 0;
+            Uint32 refs = 0;
+            size_t bytes = 0;
+            std::string key{}; // Cache key, empty unless it was loaded through the cache
+            std::string file{}; // As it was loaded, keys are lowercased and would miss on case sensitive file systems
+        };
+
+        static std::vector<TextureSlot> slots;
+        static std::vector<int> freeSlots;
+
+        static std::unordered_map<SDL_Texture*, int> handles;
+        static std::unordered_map<std::string, int> paths;
+
+        static size_t liveCount;
+        static size_t liveBytes;
+        static Uint64 decodes;
+
+        static int AllocateSlot(SDL_Texture* texture);
+        static void FreeSlot(int id);
 
     public:
-        static SDL_Texture* GetTexture(int id) { return textures.at(id); }
+        static SDL_Texture* GetTexture(int id) { return slots.at(id).texture; }
+        static const std::string& GetPath(int id) { return slots.at(id).file; }
+        static SDL_Texture* GetTexture(TextureHandle handle) { return IsValid(handle) ? slots[handle.id].texture : nullptr; }
+        static bool IsValid(TextureHandle handle)
+        {
+            return handle.id >= 0 && static_cast<size_t>(handle.id) < slots.size() && slots[handle.id].generation == handle.generation &&
+                slots[handle.id].texture != nullptr;
+        }
+
+        // Takes ownership of a texture made elsewhere, DestroyTexture frees it
+        static int CreateTexture(SDL_Texture* texture) { return AllocateSlot(texture); }
+        static void DestroyTexture(int id);
 
-        // FIXME: Make the texture manager store the texture instead of the sprite object
-        static int CreateTexture(SDL_Texture* texture) 
+        // The handle of a texture, only registering it the first time it is seen
+        static int GetHandle(SDL_Texture* texture)
         {
-            textures.push_back(texture);
+            auto it = handles.find(texture);
+            if (it != handles.end()) return it->second;
 
-            return textures.size() - 1;
+            return CreateTexture(texture);
         }
+
+        // Shared texture for an image file, decoded only the first time. Each Load needs a Release.
+        static TextureHandle Load(SDL_Renderer* renderer, const std::string& path);
+        // Uploads an already decoded image into the cache, frees the surface. Returns one reference.
+        static TextureHandle Adopt(SDL_Renderer* renderer, const std::string& path, SDL_Surface* surface);
+        static void AddRef(TextureHandle handle) { if (IsValid(handle)) slots[handle.id].refs++; }
+        static void Release(TextureHandle handle);
+
+        static size_t GetLiveCount() { return liveCount; }
+        static size_t GetLiveBytes() { return liveBytes; }
+        static Uint64 GetDecodeCount() { return decodes; }
+    };
+
+    struct AtlasRegion
+    {
+        int textureId = -1;
+        SDL_Rect rect{};
+    };
+
+    // Packs every image in a directory into a handful of large pages at startup
+    class TextureAtlas
+    {
+    private:
+        const int PADDING = 1;
+
+        std::unordered_map<std::string, AtlasRegion> regions{};
+        std::vector<int> pages{};
+        int pageSize = 2048;
+
+    public:
+        // Lookup key for an image path, shared with the texture cache
+        static std::string GetKey(std::string path);
+
+        bool Build(SDL_Renderer* renderer, const char* directory);
+        // Packs decoded images, leaving only the ones too large for a page in images
+        void Pack(SDL_Renderer* renderer, std::vector<LoadedImage>& images);
+        void Destroy();
+
+        bool GetRegion(const char* path, AtlasRegion& region);
+        size_t GetPageCount() { return pages.size(); }
+        size_t GetRegionCount() { return regions.size(); }
     };
 
-    struct RenderObject 
+    // Draw order between groups, anything on the same layer may be reordered to batch by texture
+    enum RenderLayer : Sint16
+    {
+        LAYER_GROUND = 0,
+        LAYER_OBJECTS = 10,
+        LAYER_ENTITIES = 20,
+        LAYER_LIGHTING = 25,
+        LAYER_OVERLAY = 30,
+        LAYER_UI = 40,
+    };
+
+    struct RenderObject
     {
         Color color{ 0xFF, 0xFF, 0xFF, 0xFF };
         int textureId = -1;
         SDL_Rect rect{}, sprRect{};
         bool flipped = false;
+        bool padded = true; // Grown by a pixel to hide seams between neighbouring tiles
+        Sint16 layer = LAYER_UI;
+        SDL_BlendMode blend = SDL_BLENDMODE_BLEND;
 
         const SDL_RendererFlip GetFlipped() { return flipped ? SDL_FLIP_HORIZONTAL : SDL_FLIP_NONE; }
 
         RenderObject(SDL_Texture* texture, SDL_Rect rect, SDL_Rect sprRect) 
         {
-            textureId = TextureManager::CreateTexture(texture);
+            textureId = TextureManager::GetHandle(texture);
             this->rect = rect;
             this->sprRect = sprRect;
         }
         RenderObject() = default;
     };
 
+    enum RenderFlags : Uint8
+    {
+        RENDER_FLIPPED = 1,
+        RENDER_PADDED = 2,
+        RENDER_CAMERA = 4, // rect is in world space and goes through the camera
+    };
+
+    // One queued draw. Plain data referring to its texture by handle, so the queue is reused frame to frame without allocating.
+    struct RenderCommand
+    {
+        int textureId = -1;
+        SDL_Rect rect{};
+        Sint16 srcX = 0, srcY = 0, srcW = 0, srcH = 0;
+        Color color{ 0xFF, 0xFF, 0xFF, 0xFF };
+        Sint16 layer = LAYER_UI;
+        Uint8 blend = SDL_BLENDMODE_BLEND;
+        Uint8 flags = RENDER_PADDED;
+
+        RenderCommand() = default;
+        RenderCommand(const RenderObject& ro)
+        {
+            textureId = ro.textureId;
+            rect = ro.rect;
+            srcX = static_cast<Sint16>(ro.sprRect.x);
+            srcY = static_cast<Sint16>(ro.sprRect.y);
+            srcW = static_cast<Sint16>(ro.sprRect.w);
+            srcH = static_cast<Sint16>(ro.sprRect.h);
+            color = ro.color;
+            layer = ro.layer;
+            blend = static_cast<Uint8>(ro.blend);
+            flags = (ro.flipped ? RENDER_FLIPPED : 0) | (ro.padded ? RENDER_PADDED : 0);
+        }
+
+        SDL_Rect GetSrc() const { return { srcX, srcY, srcW, srcH }; }
+    };
+
+    // Where a sprite's frames sit on its texture, frames run left to right from the origin.
+    // Doesn't own the texture, the sprite it came from has to outlive it.
+    struct SpriteHandle
+    {
+        int textureId = -1;
+        Sint16 originX = 0, originY = 0;
+        Sint16 frameW = 0, frameH = 0;
+    };
+
     struct RenderText 
     {
         std::string text = "";
@@ -360,6 +551,70 @@ namespace gobl
         }
     };
 
+    // Printable ASCII, anything else is drawn as '?'
+    const int GLYPH_FIRST = 32;
+    const int GLYPH_COUNT = 95;
+
+    struct Glyph
+    {
+        SDL_Rect rect{};
+        int advance = 0;
+    };
+
+    // Every glyph of the font at one size, rendered once into a single texture
+    struct FontPage
+    {
+        int textureId = -1;
+        int width = 0, height = 0;
+        int lineHeight = 0;
+        Glyph glyphs[GLYPH_COUNT]{};
+
+        const Glyph& GetGlyph(char c) const
+        {
+            int i = static_cast<unsigned char>(c) - GLYPH_FIRST;
+            if (i < 0 || i >= GLYPH_COUNT) i = '?' - GLYPH_FIRST;
+
+            return glyphs[i];
+        }
+    };
+
+    // Glyph positions of a string, relative to where it is drawn
+    struct TextLayout
+    {
+        Uint64 hash = 0;
+        int size = 0;
+        std::string text = "";
+        std::vector<SDL_Rect> src{};
+        std::vector<SDL_Rect> dest{};
+        int w = 0, h = 0;
+        Uint64 lastUsed = 0;
+        bool used = false;
+    };
+
+    class GlyphCache
+    {
+    private:
+        // Layouts live in a fixed table, a miss reuses the least recently drawn slot nearby along with its storage
+        const size_t LAYOUT_SLOTS = 256;
+        const size_t LAYOUT_PROBES = 8;
+
+        std::unordered_map<int, FontPage> pages{};
+        std::vector<TextLayout> layouts{};
+        Uint64 frame = 0;
+
+    public:
+        FontPage* GetPage(SDL_Renderer* renderer, TTF_Font* font, int size);
+        const TextLayout& GetLayout(const FontPage& page, int size, const char* text, size_t length);
+
+        void EndFrame();
+        void Destroy();
+
+        size_t GetPageCount() { return pages.size(); }
+    };
+
+    // Heap allocations made by the calling thread so far, only counted in debug builds or with GOBL_COUNT_ALLOCATIONS
+    Uint64 GetAllocationCount();
+
     inline bool CriticalError(const char* out)
     {
         std::cout << "CRITICAL ERROR: " << out << std::endl;
@@ -378,6 +633,8 @@ namespace gobl
         Sint32 mouseWheel = 0;
         Sint32 prevMouseWheel = 0;
 
+        Uint32 lastInputTime = 0;
+
         std::unordered_map<Sint32, KeyState> keyMap;
 
     public:
@@ -394,41 +651,223 @@ namespace gobl
         static bool GetMouseButtonUp(Uint8 b) { return instance->mouseButton != b && instance->prevButton == b; }
         static float GetMouseWheel() { return static_cast<float>(instance->mouseWheel - instance->prevMouseWheel); }
         static IntVec2 GetMouse() { return { instance->mouseX, instance->mouseY }; }
+        // Milliseconds since the last event of any kind
+        static Uint32 GetIdleTime() { return SDL_GetTicks() - instance->lastInputTime; }
 
         // Functional stuff
         void SetEatInput(int amnt) { eatInput = amnt; }
         Uint64 GetEatInput() { return eatInput; }
     };
 
+    // World to screen for one frame, trig worked out once instead of per vertex
+    struct CameraTransform
+    {
+        float posX = 0, posY = 0;
+        float halfW = 0, halfH = 0;
+        float zoom = 1, cos = 1, sin = 0;
+
+        SDL_FPoint Apply(float x, float y) const
+        {
+            float dx = (x - posX - halfW) * zoom;
+            float dy = (y - posY - halfH) * zoom;
+
+            return { halfW + dx * cos - dy * sin, halfH + dx * sin + dy * cos };
+        }
+    };
+
     struct Camera 
     {
     public:
+        const float MIN_ZOOM = 0.25f;
+        const float MAX_ZOOM = 4.0f;
+
+        // pos is the world point at the top left of the screen when unzoomed and unrotated,
+        // zoom and rotation (degrees) happen around the middle of the screen
         Vec2 pos{};
-        float zoom = 0;
+        float zoom = 1.0f;
         float angle = 0;
+        Vec2 viewSize{};
 
-        SDL_Rect GetRect(SDL_Rect rect) 
+        CameraTransform GetTransform() const
         {
-            rect.x -= static_cast<int>(pos.x);
-            rect.y -= static_cast<int>(pos.y);
+            const float DEG_TO_RAD = 0.01745329252f;
+
+            CameraTransform t{};
+            t.posX = pos.x;
+            t.posY = pos.y;
+            t.halfW = viewSize.x / 2.0f;
+            t.halfH = viewSize.y / 2.0f;
+            t.zoom = zoom;
+            t.cos = std::cos(angle * DEG_TO_RAD);
+            t.sin = std::sin(angle * DEG_TO_RAD);
+
+            return t;
+        }
 
-            // FIXME: Add zoom and rotation
+        Vec2 WorldToScreen(Vec2 p) const
+        {
+            SDL_FPoint s = GetTransform().Apply(p.x, p.y);
+            return { s.x, s.y };
+        }
+
+        // A screen space offset as the world offset under it
+        Vec2 ScreenDeltaToWorld(Vec2 d) const
+        {
+            CameraTransform t = GetTransform();
+            return { (d.x * t.cos + d.y * t.sin) / zoom, (-d.x * t.sin + d.y * t.cos) / zoom };
+        }
 
-            return rect;
+        Vec2 ScreenToWorld(Vec2 p) const
+        {
+            Vec2 d = ScreenDeltaToWorld({ p.x - viewSize.x / 2.0f, p.y - viewSize.y / 2.0f });
+            return { pos.x + viewSize.x / 2.0f + d.x, pos.y + viewSize.y / 2.0f + d.y };
         }
+        Vec2 ScreenToWorld(IntVec2 p) const { return ScreenToWorld(Vec2{ static_cast<float>(p.x), static_cast<float>(p.y) }); }
+
+        // World space bounds of everything on screen
+        SDL_FRect GetVisibleRect() const
+        {
+            Vec2 corners[4] = { ScreenToWorld(Vec2{ 0, 0 }), ScreenToWorld(Vec2{ viewSize.x, 0 }),
+                ScreenToWorld(Vec2{ 0, viewSize.y }), ScreenToWorld(Vec2{ viewSize.x, viewSize.y }) };
+
+            float minX = corners[0].x, minY = corners[0].y, maxX = corners[0].x, maxY = corners[0].y;
+            for (auto& c : corners)
+            {
+                minX = std::min(minX, c.x);
+                minY = std::min(minY, c.y);
+                maxX = std::max(maxX, c.x);
+                maxY = std::max(maxY, c.y);
+            }
+
+            return { minX, minY, maxX - minX, maxY - minY };
+        }
+
+        // Screen bounds of a world rect, ignores rotation. World draws should go through the render queue instead.
+        SDL_Rect GetRect(SDL_Rect rect) 
+        {
+            Vec2 p = WorldToScreen(Vec2{ static_cast<float>(rect.x), static_cast<float>(rect.y) });
+
+            return { static_cast<int>(p.x), static_cast<int>(p.y), static_cast<int>(rect.w * zoom), static_cast<int>(rect.h * zoom) };
+        }
+    };
+
+    enum FramePacing : Uint8
+    {
+        PACING_UNCAPPED = 0,
+        PACING_VSYNC,
+        PACING_CAPPED, // Sleeps then spins to hold targetFps
+        PACING_ADAPTIVE, // Vsync, dropping to the limiter while frames miss the refresh
+    };
+
+    struct PacingSettings
+    {
+        FramePacing mode = PACING_VSYNC;
+        Uint32 targetFps = 60;
+        Uint32 idleFps = 10; // Unfocused window or a static scene
+    };
+
+    // Holds the main loop to the chosen pacing, call once at the end of every frame
+    class FramePacer
+    {
+    private:
+        // SDL_Delay can oversleep by a scheduler quantum, the rest of the wait is spun
+        const double SPIN_SECONDS = 0.002;
+        const Uint32 ADAPTIVE_MISSES = 5;
+        const Uint32 ADAPTIVE_RECOVER = 60;
+
+        PacingSettings settings{};
+        SDL_Renderer* renderer = nullptr;
+        double frequency = 1.0;
+        Uint64 frameStart = 0;
+        bool vsync = false;
+        Uint32 misses = 0, hits = 0;
+
+        void WaitUntil(Uint64 deadline, bool wakeOnInput);
+
+    public:
+        void Configure(const PacingSettings& pacing, SDL_Renderer* sdlRenderer, bool vsyncEnabled);
+        void EndFrame(bool idle);
+
+        FramePacing GetMode() { return settings.mode; }
+        bool GetVsync() { return vsync; }
+    };
+
+    // Runs the renderer without a window or GPU, for build machines
+    struct HeadlessSettings
+    {
+        bool enabled = false;
+        Uint32 frameLimit = 0; // Quit after this many frames, 0 runs until the game exits
+        std::vector<Uint32> captureFrames{}; // Frames to save as PNG
+        std::string captureDirectory = "Captures/";
     };
 
     class GoblRenderer
     {
     private:
         SDL_Window* m_window = NULL;
+        SDL_Surface* headlessSurface = NULL;
+        HeadlessSettings headless{};
+        Uint32 frameIndex = 0;
+        PacingSettings pacing{};
         SDL_Renderer* sdlRenderer = NULL;
         SDL_Texture* bgTex = NULL;
         Uint32* m_buffer = nullptr;
-        bool shouldUpdateTexture = true;
 
-        std::vector<RenderObject> renderObjects;
-        std::vector<RenderText> strings;
+        // Regions of m_buffer changed since the last upload
+        const size_t MAX_DIRTY_RECTS = 16;
+        std::vector<SDL_Rect> dirtyRects{};
+        bool backgroundEnabled = true;
+        bool backgroundDrawn = false;
+
+        // Queued text, the characters of every string live back to back in textArena
+        struct TextCommand
+        {
+            Uint32 offset = 0, length = 0;
+            int size = 0, x = 0, y = 0;
+            Uint8 r = 0, g = 0, b = 0;
+            Uint16 outline = 0;
+        };
+
+        std::vector<RenderCommand> commands{};
+        std::vector<Uint64> renderOrder{};
+        std::vector<TextCommand> strings{};
+        std::vector<char> textArena{};
+
+        // Untextured rects drawn over the sprites and under the text
+        struct FillCommand
+        {
+            SDL_Rect rect{};
+            SDL_Color color{};
+        };
+
+        std::vector<FillCommand> fills{};
+
+        // Batching, kept between frames so the buffers only grow
+        std::vector<SDL_Vertex> vertices{};
+        std::vector<int> indices{};
+        bool useGeometry = true;
+
+        Uint32 drawCalls = 0, pendingDrawCalls = 0;
+        Uint32 submittedObjects = 0, pendingObjects = 0;
+        Uint64 renderAllocations = 0, pendingAllocations = 0;
+
+        Camera* camera = nullptr;
+        CameraTransform view{};
+
+        // Queue set aside while drawing into a render target
+        std::vector<RenderCommand> stashedCommands{};
+        int targetId = -1;
+        float targetScale = 1.0f;
+
+        // Kept between blurs so they only grow
+        std::vector<Uint32> blurPixels{};
+        std::vector<Uint32> blurScratch{};
+
+        // Command stream recording, see RenderCapture.cpp
+        std::string recordPath{};
+        SDL_RWops* recording = NULL;
+        std::unordered_map<int, SDL_Texture*> recordedTextures{}; // What each id pointed at when it was last written
+        std::vector<Uint8> recordBuffer{}; // Reused, each frame is built here and written at once
 
         const char* windowTitle = "undef";
         const char* windowInfo = "";
@@ -436,7 +875,10 @@ namespace gobl
 
         // Fonts
         std::string defaultFontName = "Fonts/Alkhemikal.ttf";
-        TTF_Font* defaultFont;
+        TTF_Font* defaultFont = NULL;
+
+        TextureAtlas atlas{};
+        GlyphCache glyphs{};
 
     public:
         GoblRenderer() = default;
@@ -445,6 +887,25 @@ namespace gobl
     public:
         bool Init();
         void Close();
+        bool BuildAtlas(const char* directory) { return atlas.Build(sdlRenderer, directory); }
+        void PackAtlas(std::vector<LoadedImage>& images) { atlas.Pack(sdlRenderer, images); }
+        bool GetAtlasRegion(const char* path, AtlasRegion& region) { return atlas.GetRegion(path, region); }
+        void SetCamera(Camera* cam) { camera = cam; }
+        // Must be called before Init, settings from init.json are used otherwise
+        void SetHeadless(const HeadlessSettings& settings) { headless = settings; }
+        bool IsHeadless() { return headless.enabled; }
+        // Headless runs are measured, so they never wait
+        PacingSettings GetPacing() { return headless.enabled ? PacingSettings{ PACING_UNCAPPED } : pacing; }
+        bool GetVsync() { return headless.enabled == false && (pacing.mode == PACING_VSYNC || pacing.mode == PACING_ADAPTIVE); }
+        bool IsFocused() { return m_window == NULL || (SDL_GetWindowFlags(m_window) & SDL_WINDOW_INPUT_FOCUS) != 0; }
+        bool IsMinimized() { return m_window != NULL && (SDL_GetWindowFlags(m_window) & SDL_WINDOW_MINIMIZED) != 0; }
+        bool CaptureFrame(const std::string& path);
+        Camera* GetCamera() { return camera; }
+        // Must be called before Init, every presented frame is then written to path
+        void SetRecordPath(const std::string& path) { recordPath = path; }
+        bool IsRecording() { return recording != NULL; }
+        // Draws a recorded session back through the render path and prints the frame times
+        bool Replay(const std::string& path, Uint32 loops = 1);
 
     public:
         void SetWinTitle(const char* title) 
@@ -467,22 +928,62 @@ namespace gobl
         void Present();
         void SetPixel(int x, int y, Uint8 r, Uint8 g, Uint8 b);
         void ClearScreen(Color c = { 0, 0, 0, 0 });
+        void MarkDirty(SDL_Rect rect);
+
+        // Software drawing into the background buffer
+        void FillSpan(int x, int y, int length, Color c);
+        void FillRect(SDL_Rect rect, Color c);
+        void DrawLine(IntVec2 a, IntVec2 b, Color c);
+        void BlitSurface(SDL_Surface* surface, int x, int y) { BlitSurface(surface, x, y, Color::WHITE); }
+        void BlitSurface(SDL_Surface* surface, int x, int y, Color tint);
+        void SetBackgroundEnabled(bool enabled) { backgroundEnabled = enabled; }
+        bool GetBackgroundEnabled() { return backgroundEnabled; }
         SDL_Texture* LoadTexture(const char* path, SDL_Rect& rect, SDL_Rect& sprRect);
         void DrawTexture(SDL_Texture* texture, SDL_Rect& rect, SDL_Rect& sprRect);
         void QueueTexture(SDL_Texture* texture, SDL_Rect& rect, SDL_Rect& sprRect);
-        void QueueTexture(RenderObject ro);
-
-        void QueueString(std::string text, int size, int x, int y, Uint8 r, Uint8 g, Uint8 b);
-        void QueueString(RenderText t);
+        void QueueTexture(const RenderObject& ro) { QueueCommand(ro); }
+        void QueueCommand(const RenderCommand& command);
+        // Queues one frame of a sprite without touching the Sprite it came from
+        void DrawSprite(const SpriteHandle& sprite, int frame, IntVec2 pos, float scale = 1.0f, Color tint = Color::WHITE,
+            bool flip = false, bool cameraRelative = false, Sint16 layer = LAYER_UI);
+
+        int CreateRenderTarget(int w, int h);
+        // Plain texture for pixels uploaded from the CPU, filtered when stretched
+        int CreateBlankTexture(int w, int h);
+        // Scale shrinks everything drawn into the target, for rendering the screen at a lower resolution
+        void BeginTarget(int textureId, float scale = 1.0f);
+        void EndTarget();
+        // Reads a render target back, blurs it and uploads the result to output
+        bool BlurTarget(int sourceId, int outputId, int radius, int passes = 2);
+
+        void QueueString(const std::string& text, int size, int x, int y, Uint8 r, Uint8 g, Uint8 b);
+        void QueueString(const RenderText& t);
+        IntVec2 MeasureString(const std::string& text, int size);
+        void QueueFill(SDL_Rect rect, SDL_Color color) { fills.push_back({ rect, color }); }
 
     private:
+        bool StartRecording();
+        void StopRecording();
+        void RecordFrame();
+        void DrawFills();
         void DrawStrings();
         void RenderSurfaces();
+        void SubmitBatch(size_t start, size_t end);
+        void SortCommands();
+        void PushQuad(const SDL_Rect& dest, const SDL_Rect& src, int texW, int texH, SDL_Color c, bool flipped = false);
+        void PushQuad(const SDL_FPoint corners[4], const SDL_Rect& src, int texW, int texH, SDL_Color c, bool flipped = false);
+        void SubmitGeometry(SDL_Texture* texture);
 
     public: // Public accessors
         SDL_Renderer* GetRenderer() { return sdlRenderer; }
+        Uint32 GetDrawCalls() { return drawCalls; }
+        Uint32 GetSubmittedObjects() { return submittedObjects; }
+        // Heap allocations made by the render path last frame, -1 when they aren't being counted
+        long long GetRenderAllocations() { return GetAllocationCount() == 0 ? -1 : static_cast<long long>(renderAllocations); }
+        size_t GetGlyphPageCount() { return glyphs.GetPageCount(); }
         const int GetWindowWidth() { return WINDOW_WIDTH; }
         const int GetWindowHeight() { return WINDOW_HEIGHT; }
+        Uint32 GetFrameIndex() { return frameIndex; }
     };
 
     class Sprite
@@ -491,6 +992,10 @@ namespace gobl
         RenderObject renderObject{};
         IntVec2 staticDim{};
 
+        // Where this sprite sits on its texture, atlas pages hold many sprites
+        SDL_Point origin{ 0, 0 };
+        TextureHandle texture{}; // Set when the image came from the texture cache instead of the atlas
+
         GoblRenderer* renderer = nullptr;
 
     public:
@@ -499,6 +1004,9 @@ namespace gobl
         Sprite* Draw();
         Sprite* DrawRelative(Camera* cam);
 
+        Sprite* SetLayer(Sint16 layer) { renderObject.layer = layer; return this; }
+        Sprite* SetBlendMode(SDL_BlendMode blend) { renderObject.blend = blend; return this; }
+        Sprite* SetPadded(bool padded) { renderObject.padded = padded; return this; }
         Sprite* SetAlpha(Uint8 alpha) { renderObject.color.a = alpha; return this; }
         Sprite* SetColorMod(Color c) { renderObject.color = { c.r, c.g, c.b, c.a }; return this; }
 
@@ -528,6 +1036,11 @@ namespace gobl
 
         // Accessors
         IntVec2 GetPosition() { return { renderObject.rect.x, renderObject.rect.y }; }
+        SpriteHandle GetSpriteHandle()
+        {
+            return { renderObject.textureId, static_cast<Sint16>(origin.x), static_cast<Sint16>(origin.y),
+                static_cast<Sint16>(renderObject.sprRect.w), static_cast<Sint16>(renderObject.sprRect.h) };
+        }
         std::string GetRectDebugInfo();
 
     public:
@@ -535,18 +1048,30 @@ namespace gobl
         void Create(GoblRenderer* _renderer, const char* path);
 
         Sprite() = default;
-        //Sprite(const Sprite&) = delete;
         Sprite(GoblRenderer* _renderer, const char* path = "") : renderer(_renderer)
         {
             if (path != "") LoadTexture(path);
         }
 
-        // FIXME: This might not work...
-        ~Sprite()
-        { 
-            if (renderObject.textureId != -1) 
-                SDL_DestroyTexture(TextureManager::GetTexture(renderObject.textureId)); 
+        // Copies share the cached texture
+        Sprite(const Sprite& other) { *this = other; }
+        Sprite& operator=(const Sprite& other)
+        {
+            if (this == &other) return *this;
+
+            TextureManager::AddRef(other.texture);
+            TextureManager::Release(texture);
+
+            renderObject = other.renderObject;
+            staticDim = other.staticDim;
+            origin = other.origin;
+            texture = other.texture;
+            renderer = other.renderer;
+
+            return *this;
         }
+
+        ~Sprite() { TextureManager::Release(texture); }
     };
 
     //class Object
@@ -565,6 +1090,12 @@ namespace gobl
         static GoblEngine* instance;
 
         GoblRenderer renderer{};
+        FramePacer pacer{};
+        bool sceneStatic = false;
+
+        // Startup assets, decoded on workers while the splash plays
+        AssetLoader loader{};
+        std::vector<TextureHandle> preloaded{};
         Sprite* splash = nullptr;
         Camera* cam = nullptr;
         SDLAudio* audio = nullptr;
@@ -583,13 +1114,16 @@ namespace gobl
         {
             instance = this;
 
-            audio = new SDLAudio(0);
             cam = new Camera();
             InputManager inputManager{};
             Init();
 
             renderer.Init();
+            audio = new SDLAudio(0); // After the renderer so a headless run gets the dummy audio driver
             renderer.ClearScreen();
+            cam->viewSize = { static_cast<float>(renderer.GetWindowWidth()), static_cast<float>(renderer.GetWindowHeight()) };
+            renderer.SetCamera(cam);
+            pacer.Configure(renderer.GetPacing(), renderer.GetRenderer(), renderer.GetVsync());
 
             ngnLogo = new Sprite(&renderer, "Sprites/goblEngineLogo_Egg.png");
             splash = new Sprite(&renderer, "Sprites/gobleLogoAnim.png");
@@ -597,6 +1131,10 @@ namespace gobl
             splash->SetDimensions(64, 64);
             splash->SetScale(6.0f);
 
+            loader.Start();
+            loader.QueueDirectory("Sprites/");
+            Preload(loader);
+
             bool appRunning = true;
 
             while (appRunning)
@@ -608,16 +1146,30 @@ namespace gobl
 
                 time.Tick();
 
-                if (InputManager::instance->PollEvents() == false) appRunning = false;
+                {
+                    ProfileScope events(PROFILE_EVENTS);
+                    if (InputManager::instance->PollEvents() == false) appRunning = false;
+                }
 
-                if (Splash() == false) break;
+                // The splash holds until everything has loaded
+                if (Splash() == false && loader.IsDone()) break;
                 splashTime -= static_cast<float>(time.deltaTime);
-                Debug();
+                DrawLoadingBar();
+                {
+                    ProfileScope debug(PROFILE_DEBUG);
+                    Debug();
+                }
 
                 renderer.Present();
+                {
+                    ProfileScope idle(PROFILE_IDLE);
+                    pacer.EndFrame(IsIdle());
+                }
+                Profiler::EndFrame(renderer.GetDrawCalls(), static_cast<Uint32>(renderer.GetGlyphPageCount()));
             }
 
             delete splash;
+            FinishLoading();
 
             while (appRunning)
             {
@@ -629,13 +1181,31 @@ namespace gobl
                     renderer.PresentBackground();
 
                     // Get input for the next frame
-                    if (InputManager::instance->PollEvents() == false) break;
-                    if (Update() == false) break;
+                    {
+                        ProfileScope events(PROFILE_EVENTS);
+                        if (InputManager::instance->PollEvents() == false) break;
+                    }
+                    // Simulation runs at a fixed rate no matter the frame rate
+                    while (time.StepSimulation()) FixedUpdate();
+
+                    {
+                        ProfileScope update(PROFILE_UPDATE);
+                        if (Update() == false) break;
+                    }
 
                     // Draw the current frame content
                     Draw(renderer);
                     renderer.Present();
-                    Debug();
+                    {
+                        ProfileScope debug(PROFILE_DEBUG);
+                        Debug();
+                    }
+                    // The frame closes after the sleep so the stages add up to the wall clock frame time
+                    {
+                        ProfileScope idle(PROFILE_IDLE);
+                        pacer.EndFrame(IsIdle());
+                    }
+                    Profiler::EndFrame(renderer.GetDrawCalls(), static_cast<Uint32>(renderer.GetGlyphPageCount()));
 
                     time.Tick();
                 }
@@ -643,6 +1213,9 @@ namespace gobl
                 if (Exit() == true) break;
             }
 
+            for (auto& handle : preloaded) TextureManager::Release(handle);
+            preloaded.clear();
+
             renderer.Close();
             SDL_Quit();
             IMG_Quit();
@@ -655,10 +1228,41 @@ namespace gobl
         void CreateSpriteObject(Sprite& sprite, const char* path) { sprite.Create(&renderer, path); }
 
         Sprite* GetEngineLogo() { return ngnLogo; }
+        GoblRenderer& GetRenderer() { return renderer; }
+        void SetHeadless(const HeadlessSettings& settings) { renderer.SetHeadless(settings); }
+        void SetRecordPath(const std::string& path) { renderer.SetRecordPath(path); }
         SDLAudio* GetAudio() { return audio; }
 
+    private:
+        // Uploads what the workers decoded, the only part of loading on the main thread
+        void FinishLoading()
+        {
+            std::vector<LoadedImage> images{};
+
+            loader.Stop();
+            loader.TakeImages(images);
+            renderer.PackAtlas(images);
+
+            // Too large for the atlas, keep them cached so sprites don't decode them again
+            for (auto& image : images) preloaded.push_back(TextureManager::Adopt(renderer.GetRenderer(), image.path, image.surface));
+        }
+
+        void DrawLoadingBar()
+        {
+            if (loader.IsDone()) return;
+
+            const int BAR_W = 300, BAR_H = 6;
+            int x = (static_cast<int>(GetScreenWidth()) - BAR_W) / 2;
+            int y = static_cast<int>(GetScreenHeight()) - 60;
+
+            renderer.QueueFill({ x, y, BAR_W, BAR_H }, { 0x40, 0x40, 0x40, 0xFF });
+            renderer.QueueFill({ x, y, static_cast<int>(BAR_W * loader.GetProgress()), BAR_H }, { 0xFF, 0xFF, 0xFF, 0xFF });
+        }
+
     protected:
         virtual void Init() { SetTitle("demo"); }
+        // Queue work for the splash screen loader, nothing here may use the renderer
+        virtual void Preload(AssetLoader& /*loader*/) {}
         virtual bool Splash()
         {
             splash->Draw();
@@ -681,6 +1285,7 @@ namespace gobl
             return splashTime > 0.0f;
         }
         virtual bool Start() { return true; }
+        virtual void FixedUpdate() {} // Fixed rate simulation tick, see Clock::GetFixedDelta
         virtual bool Update() { return true; }
         virtual void Draw(GoblRenderer& renderer) {}
         virtual void Debug()
@@ -696,6 +1301,15 @@ namespace gobl
 
                 DrawOutlinedString(std::to_string(time.deltaTime), 0, 0, 20, 3U);
                 DrawOutlinedString(std::to_string(time.GetFps()), 0, 20, 20, 3U);
+                DrawOutlinedString("draws " + std::to_string(renderer.GetDrawCalls()) + "/" + std::to_string(renderer.GetSubmittedObjects()), 0, 60, 20, 3U);
+                if (renderer.GetRenderAllocations() >= 0)
+                    DrawOutlinedString("render allocs " + std::to_string(renderer.GetRenderAllocations()), 0, 80, 20, 3U);
+                DrawOutlinedString("textures " + std::to_string(TextureManager::GetLiveCount()) + " " +
+                    std::to_string(TextureManager::GetLiveBytes() / 1024) + "KB", 0, 100, 20, 3U);
+                DrawProfile();
+
+                if (InputManager::GetKeyPressed(SDLK_F4))
+                    Profiler::DumpCsv("Profiles/frames_" + std::to_string(time.GetFrames()) + ".csv");
 
                 std::string value = "- FPS: " + std::to_string(time.GetFps());
                 value += " delta: " + std::to_string(time.deltaTime);
@@ -705,13 +1319,70 @@ namespace gobl
         }
         virtual bool Exit() { return true; } // Return true to complete exit
 
+        // Stacked frame time graph of the profiled stages, newest frame on the right
+        void DrawProfile()
+        {
+            const int GRAPH_H = 120;
+            const float PX_PER_MS = GRAPH_H / 33.3f;
+            int left = 0;
+            int bottom = GetScreenHeight() - 10;
+
+            renderer.QueueFill({ left, bottom - GRAPH_H, static_cast<int>(Profiler::HISTORY), GRAPH_H }, { 0, 0, 0, 0x80 });
+
+            for (size_t age = 0; age < Profiler::GetFrameCount(); age++)
+            {
+                const ProfileFrame& frame = Profiler::GetFrame(age);
+                int x = left + static_cast<int>(Profiler::HISTORY - 1 - age);
+                float y = static_cast<float>(bottom);
+
+                for (Uint8 s = 0; s < PROFILE_STAGE_COUNT && y > bottom - GRAPH_H; s++)
+                {
+                    float h = frame.stages[s] * PX_PER_MS;
+                    if (h < 0.5f) continue;
+
+                    int top = std::max(bottom - GRAPH_H, static_cast<int>(y - h));
+                    renderer.QueueFill({ x, top, 1, static_cast<int>(y) - top }, Profiler::GetStageColor(static_cast<ProfileStage>(s)));
+                    y -= h;
+                }
+            }
+
+            // 60 and 30 fps budgets
+            renderer.QueueFill({ left, bottom - static_cast<int>(16.7f * PX_PER_MS), static_cast<int>(Profiler::HISTORY), 1 }, { 0xFF, 0xFF, 0xFF, 0x60 });
+            renderer.QueueFill({ left, bottom - GRAPH_H, static_cast<int>(Profiler::HISTORY), 1 }, { 0xFF, 0x40, 0x40, 0x60 });
+
+            const ProfileFrame& last = Profiler::GetFrame(0);
+            int textY = bottom - GRAPH_H - 60;
+            DrawOutlinedString("p50 " + std::to_string(Profiler::GetPercentile(50)).substr(0, 5) + " p95 " + std::to_string(Profiler::GetPercentile(95)).substr(0, 5) +
+                " p99 " + std::to_string(Profiler::GetPercentile(99)).substr(0, 5) + " ms", left, textY, 20, 3U);
+            DrawOutlinedString("text pages " + std::to_string(last.textPages) + " - F4 dumps csv", left, textY + 20, 20, 3U);
+
+            int legendX = left + static_cast<int>(Profiler::HISTORY) + 6;
+            for (Uint8 s = 0; s < PROFILE_STAGE_COUNT; s++)
+            {
+                SDL_Color c = Profiler::GetStageColor(static_cast<ProfileStage>(s));
+                int legendY = bottom - GRAPH_H + s * (GRAPH_H / PROFILE_STAGE_COUNT);
+
+                DrawOutlinedString(Profiler::GetStageName(static_cast<ProfileStage>(s)), legendX, legendY, 12, 2U, c.r, c.g, c.b);
+            }
+        }
+
     public:
         void SetTitle(const char* title) { renderer.SetWinTitle(title); }
+        // Nothing is animating, so with no input the loop can drop to the idle rate
+        void SetSceneStatic(bool isStatic) { sceneStatic = isStatic; }
+        bool IsIdle()
+        {
+            const Uint32 IDLE_DELAY = 1000;
+
+            if (renderer.IsHeadless()) return false;
+            return renderer.IsFocused() == false || renderer.IsMinimized() || (sceneStatic && InputManager::GetIdleTime() > IDLE_DELAY);
+        }
 
         static Camera* GetCameraObject() { return instance->cam; }
         Vec2 GetCamera() { return cam->pos; }
         void MoveCamera(float mX, float mY) { cam->pos = cam->pos + Vec2{ mX, mY }; }
-        void MoveZoom(float amnt) { cam->zoom += amnt; }
+        void MoveZoom(float amnt) { cam->zoom = std::max(cam->MIN_ZOOM, std::min(cam->MAX_ZOOM, cam->zoom + amnt)); }
+        void RotateCamera(float degrees) { cam->angle += degrees; }
 
         Uint32 GetScreenWidth() { return renderer.GetWindowWidth(); }
         Uint32 GetScreenHeight() { return renderer.GetWindowHeight(); }
@@ -727,6 +1398,7 @@ namespace gobl
             renderer.QueueString({ text, x, y, size, r, g, b, outlineSize });
             return *this;
         }
+        IntVec2 MeasureString(const std::string& text, int size = 20) { return renderer.MeasureString(text, size); }
     };
 }
 
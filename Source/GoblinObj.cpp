@@ -2,6 +2,8 @@
 #include "GoblinsMain.hpp"
 #include <stdio.h>
 
+uint32_t GoblinObj::nextId = 0;
+
 void GoblinObj::HandleEvents()
 {
 	if (events.empty() == true || doingTask == true) 
@@ -25,7 +27,7 @@ void GoblinObj::HandleEvents()
 		// Dequeue an event and execute it
 		doingTask = true;
 	}
-	else timer -= Clock::GetDeltaTime() * speed;
+	else timer -= Clock::GetFixedDelta() * speed;
 }
 
 void GoblinObj::MoveToTarget()
@@ -42,12 +44,12 @@ void GoblinObj::MoveToTarget()
 	}
 
 	Vec2 newPos = pos;
-	newPos.MoveTowards(targetPos, moveSpd * Clock::GetDeltaTime());
+	newPos.MoveTowards(targetPos, moveSpd * Clock::GetFixedDelta());
 
 	int mapIndex = map->GetTileFromWorldPos(static_cast<int>(newPos.x), static_cast<int>(newPos.y));
 	if (map->GetCollision(mapIndex) == false)
 	{
-		pos = newPos;
+		SetPos(newPos);
 	}
 }
 
@@ -85,14 +87,18 @@ void GoblinObj::RunTestEvents()
 
 void GoblinObj::Update()
 {
+	prevPos = pos;
+
 	if (inWorkHours)
 	{
 		HandleEvents();
 
+		// The desk was bulldozed or replaced
+		if (workableId != -1 && map->GetOwner(workableId) != static_cast<Sint32>(id)) workableId = -1;
+
 		if (workableId == -1)
 		{
-			// FIXME: Save the ID for future use
-			workableId = map->GetEmptyWorkable();
+			workableId = map->ClaimWorkable(static_cast<Sint32>(id));
 
 			if (workableId != -1)
 			{
@@ -137,11 +143,15 @@ void GoblinObj::Update()
 	}
 	else
 	{
-		// Go home and do nothing
+		// Go home and do nothing, the desk is free for whoever comes in first tomorrow
+		ReleaseDesk();
 		SetAtHome(true);
 		MoveTo(Vec2{ 0.0f, 0.0f });
 	}
+}
 
-	sprite.SetPosition(pos);
+void GoblinObj::Draw(float alpha)
+{
+	sprite.SetPosition(Vec2{ lerp(prevPos.x, pos.x, alpha), lerp(prevPos.y, pos.y, alpha) });
 	sprite.DrawRelative(gobl::GoblEngine::GetCameraObject());
 }
\ No newline at end of file
@@ -4,6 +4,7 @@
 
 #include "GoblEngine.hpp"
 #include "Map.hpp"
+#include "SpatialHash.hpp"
 #include <unordered_map>
 #include <queue>
 #include "CompositeSprite.hpp"
@@ -11,9 +12,11 @@
 class GoblinObj
 {
 private:
-	uint32_t id;
+	static uint32_t nextId;
+	uint32_t id; // Unique, workables record it as their owner
 
 	Vec2 pos{};
+	Vec2 prevPos{}; // Position at the previous simulation tick, drawing blends between the two
 	Vec2 targetPos{};
 	cSpr::CompositeSprite sprite;
 
@@ -37,25 +40,49 @@ private:
 	void HandleEvents();
 
 	MAP::Map* map = nullptr;
+	MAP::SpatialHash<GoblinObj>* grid = nullptr;
+
+	// Every change of position goes through here so the grid stays current
+	void SetPos(Vec2 p)
+	{
+		pos = p;
+		if (grid != nullptr) grid->Move(this, pos);
+	}
+
+	// Hands the desk back so another goblin can claim it
+	void ReleaseDesk()
+	{
+		if (workableId != -1 && map != nullptr) map->ReleaseWorkable(static_cast<Uint32>(workableId), static_cast<Sint32>(id));
+		workableId = -1;
+	}
 
 public: // Accessors
 	const Vec2 GetPos() { return pos; };
+	uint32_t GetId() { return id; }
 	const Vec2 GetTargetPos() { return targetPos; };
 	bool ReachedTarget() 
 	{
 		bool arrived = Vec2::GetDistance(pos, targetPos) <= 0.2f;
-		if (arrived) pos = targetPos;
+		if (arrived) SetPos(targetPos);
 		return arrived;
 	}
 
 public: // Mutators
 	void SetAtHome(bool v) { atHome = v;  }
 	void AssignMap(MAP::Map* map) { this->map = map; }
+	void AssignGrid(MAP::SpatialHash<GoblinObj>* grid)
+	{
+		if (this->grid != nullptr) this->grid->Remove(this);
+
+		this->grid = grid;
+		if (grid != nullptr) grid->Insert(this, pos);
+	}
 
 public:
 	unsigned char taskProgress = 0;
 
 	void Update();
+	void Draw(float alpha);
 
 	void MoveToTarget();
 	void MoveTo(Vec2 pos);
@@ -79,6 +106,7 @@ public:
 
 		sprite.SetDimensions({ 32,32 });
 		sprite.SetReverseRenderOrder(true);
+		sprite.SetLayer(gobl::LAYER_ENTITIES);
 
 		int* indexs = new int[len];
 		for (unsigned int i = 0; i < len; i++)
@@ -90,7 +118,13 @@ public:
 
 	GoblinObj() 
 	{
-		id = rand();
+		id = nextId++;
+	}
+
+	~GoblinObj()
+	{
+		ReleaseDesk();
+		AssignGrid(nullptr);
 	}
 };
 
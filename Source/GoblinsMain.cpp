@@ -1,12 +1,12 @@
 #include "GoblinsMain.hpp"
 #include "GoblinObj.hpp"
 #include "Scripting.hpp"
+#include <filesystem>
 
 using namespace gobl;
 
 long long GoblinsMain::money = 0;
 
-IntVec2 viewArea{};
 IntVec2 startMouse{};
 IntVec2 startCell{};
 bool highlighting = false;
@@ -17,6 +17,7 @@ Color validPlacementColor = { 0, 0, 0, 150 };
 Color invalidPlacementColor = { 0, 0, 0, 75 };
 
 std::vector<GoblinObj*> goblins{};
+MAP::SpatialHash<GoblinObj> goblinGrid{}; // Goblins by the tile they stand on
 
 LuaMachine luaMachine{};
 
@@ -26,14 +27,44 @@ void GoblinsMain::HireGoblin()
 	goblin->GenerateSprite(this);
 	goblin->AssignMap(&map);
 
+	if (goblinGrid.GetCount() == 0) goblinGrid.SetCellSize(static_cast<float>(map.GetTileSize().x));
+	goblin->AssignGrid(&goblinGrid);
+
 	goblins.push_back(goblin);
 }
 
 // FIXME: Make a time manager
 unsigned char hour = 0;
 
+// Saving
+const Uint32 AUTOSAVE_TICKS = 60 * 60 * 2; // About two minutes
+Uint32 autosaveTicks = 0;
+
 // Tools
-bool CanPlace(const MAP::TileData& a, const MAP::TileData& b) { return a.buildLayer != "" && a.buildLayer == b.layer; }
+bool CanPlace(const MAP::TileData& a, const MAP::TileData& b) { return a.info.buildLayer != MAP::ATT_NONE && a.info.buildLayer == b.info.layer; }
+
+// Hit test for a sprite drawn with DrawSprite, edges count like Sprite::Overlaps
+bool SheetOverlaps(const SpriteHandle& sheet, IntVec2 pos, float scale, IntVec2 point)
+{
+	int w = static_cast<int>(sheet.frameW * scale);
+	int h = static_cast<int>(sheet.frameH * scale);
+
+	return point.x >= pos.x && point.x <= pos.x + w && point.y >= pos.y && point.y <= pos.y + h;
+}
+
+// The goblin drawn under a world position, sprites are a tile in size and drawn from their position.
+// Where sprites overlap the one centred closest to the click wins.
+GoblinObj* PickGoblin(Vec2 world, float size)
+{
+	// Positions are sprite corners, so search around where a covering sprite's corner would sit
+	Vec2 center{ world.x - size * 0.5f, world.y - size * 0.5f };
+
+	return goblinGrid.Nearest(center, size, [&](GoblinObj* goblin)
+	{
+		Vec2 pos = goblin->GetPos();
+		return world.x >= pos.x && world.x <= pos.x + size && world.y >= pos.y && world.y <= pos.y + size;
+	});
+}
 
 // Input
 bool GetMouseCam(bool handEmpty)
@@ -79,8 +110,9 @@ void GoblinsMain::DrawButton(std::string buttonText, IntVec2 pos, bool& clicked)
 		}
 	}
 
-	DrawString(buttonText, button.GetPosition().x + (button.GetScale().x / 2) - 12 * buttonText.size(),
-		button.GetPosition().y + (button.GetScale().y / 2) - 20, 50, c.r, c.g, c.b);
+	IntVec2 textSize = MeasureString(buttonText, 50);
+	DrawString(buttonText, button.GetPosition().x + (button.GetScale().x - textSize.x) / 2,
+		button.GetPosition().y + (button.GetScale().y - textSize.y) / 2, 50, c.r, c.g, c.b);
 }
 void GoblinsMain::DrawValidate(std::string prompt, bool& yes, bool& no)
 {
@@ -96,8 +128,7 @@ void GoblinsMain::DrawSelectedObject()
 	{
 		int x = 800;
 
-		map.GetTileTexture()->SetSpriteIndex(0);
-		map.GetTileTexture()->SetColorMod(Color{ 0, 0, 0, 150 })->SetPosition(x - 12, 24)->SetScale(2.1f)->Draw();
+		GetRenderer().DrawSprite(map.GetTileSheet(), 0, { x - 12, 24 }, 2.1f, Color{ 0, 0, 0, 150 });
 
 		if (tileTypeIndex < map.GetTileTypeCount()) 
 		{
@@ -108,21 +139,19 @@ void GoblinsMain::DrawSelectedObject()
 				DrawString(map.GetType(tileTypeIndex).layer, x + 50, 45);
 			}
 
-			map.GetTileTexture()->SetSpriteIndex(map.GetType(tileTypeIndex).GetIntAttribute(MAP::SPRITE_ATT));
+			SpriteHandle sheet = map.GetTileSheet();
 
-			if (map.GetTileTexture()->Overlaps(InputManager::GetMouse()))
+			if (SheetOverlaps(sheet, { x - 10, 25 }, 2.0f, InputManager::GetMouse()))
 			{
-				map.GetTileTexture()->SetScale(2.05f);
-
 				if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT)) tileTypeIndex = -1;
 			}
 
-			map.GetTileTexture()->SetColorMod(Color::WHITE)->SetPosition(x - 10, 25)->SetScale(2.0f)->Draw();
+			GetRenderer().DrawSprite(sheet, map.GetInfo(tileTypeIndex).sprite, { x - 10, 25 }, 2.0f);
 		}
 		else
 		{
 			DrawString(map.GetType(tileTypeIndex).name, x, 5);
-			DrawString("$" + std::to_string(map.GetType(tileTypeIndex).GetIntAttribute(MAP::PRICE_ATT)),
+			DrawString("$" + std::to_string(map.GetInfo(tileTypeIndex).price),
 				x - 50, 20);
 			if (debugging)
 			{
@@ -130,15 +159,14 @@ void GoblinsMain::DrawSelectedObject()
 				DrawString(map.GetType(tileTypeIndex).layer, x + 50, 45);
 			}
 
-			Uint32 texIndex = tileTypeIndex - map.GetTileTypeCount();
-			map.GetTexture(texIndex)->SetPosition(x - 10, 25)->SetScale(2.0f);
+			SpriteHandle sheet = map.GetObjectSheet(tileTypeIndex - map.GetTileTypeCount());
 
-			if (map.GetTexture(texIndex)->Overlaps(InputManager::GetMouse()))
+			if (SheetOverlaps(sheet, { x - 10, 25 }, 2.0f, InputManager::GetMouse()))
 			{
 				if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT)) tileTypeIndex = -1;
 			}
 
-			map.GetTexture(texIndex)->SetColorMod(Color::WHITE)->Draw();
+			GetRenderer().DrawSprite(sheet, 0, { x - 10, 25 }, 2.0f);
 		}
 	}
 }
@@ -154,9 +182,7 @@ bool GoblinsMain::DrawObjectOptions()
 	for (Uint32 i = 0; i < objectLength; i++)
 	{
 		// Allow highlighting of each item
-		map.GetTexture(i)->SetPosition(x, y + (50 * i))->SetScale(1.5f);
-
-		if (map.GetTexture(i)->Overlaps(InputManager::GetMouse())) 
+		if (SheetOverlaps(map.GetObjectSheet(i), { x, y + static_cast<int>(50 * i) }, 1.5f, InputManager::GetMouse()))
 		{
 			highLighting = i;
 
@@ -173,35 +199,36 @@ bool GoblinsMain::DrawObjectOptions()
 		Uint8 mouseOver = highLighting == -1 ? 0 : (highLighting == i ? 1 : 2);
 
 		// Draw each item
-		auto tex = map.GetTexture(i);
-		tex->SetPosition(x, y + (50 * i));
+		float scale = 1.0f;
+		Color tint = Color::WHITE;
 
 		switch (mouseOver)
 		{
 		case 0:
-			tex->SetScale(1.3f)->SetColorMod(Color{ 200, 200, 200, 200 });
+			scale = 1.3f;
+			tint = Color{ 200, 200, 200, 200 };
 			break;
 		case 1:
-			tex->SetScale(1.5f)->SetColorMod(Color{ 255, 255, 255, 255 });
+			scale = 1.5f;
+			tint = Color{ 255, 255, 255, 255 };
 			break;
 		case 2:
-			tex->SetScale(1.25f)->SetColorMod(Color{ 150, 150, 150, 150 });
+			scale = 1.25f;
+			tint = Color{ 150, 150, 150, 150 };
 			break;
 		default:
 			break;
 		}
 
-		tex->Draw();
+		GetRenderer().DrawSprite(map.GetObjectSheet(i), 0, { x, y + static_cast<int>(50 * i) }, scale, tint);
 	}
 
-	map.ResetTexture();
-
 	return highLighting != -1;
 }
 
 bool GoblinsMain::DrawTileOptions()
 {
-	auto mapTexture = map.GetTileTexture();
+	SpriteHandle sheet = map.GetTileSheet();
 	Uint32 highLighting = -1;
 
 	int x = 800;
@@ -209,10 +236,7 @@ bool GoblinsMain::DrawTileOptions()
 
 	for (Uint32 i = 0; i < map.GetTileTypeCount(); i++)
 	{
-		mapTexture->SetPosition(x, y + (50 * i));
-		mapTexture->SetScale(1.6f);
-
-		if (mapTexture->Overlaps(InputManager::GetMouse()))
+		if (SheetOverlaps(sheet, { x, y + static_cast<int>(50 * i) }, 1.6f, InputManager::GetMouse()))
 		{
 			if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT)) tileTypeIndex = i;
 
@@ -222,15 +246,15 @@ bool GoblinsMain::DrawTileOptions()
 
 	for (Uint32 i = 0; i < map.GetTileTypeCount(); i++)
 	{
-		int s = map.GetType(i).GetIntAttribute(MAP::SPRITE_ATT);
-		mapTexture->SetSpriteIndex(s);
+		int s = map.GetInfo(i).sprite;
+		int row = y + static_cast<int>(50 * i);
 
 		if (highLighting != -1)
 		{
 			if (highLighting == i)
 			{
 				// Mouse over this
-				mapTexture->SetColorMod({ 200, 200, 200, 255 })->SetPosition(x, y - 5 + (50 * i))->SetScale(1.6f);
+				GetRenderer().DrawSprite(sheet, s, { x, row - 5 }, 1.6f, { 200, 200, 200, 255 });
 
 				DrawString(map.GetType(i).name, x + 80, y + 10 + (50 * i));
 
@@ -240,11 +264,9 @@ bool GoblinsMain::DrawTileOptions()
 					DrawString(map.GetType(i).layer, x + 80, y + 50 + (50 * i));
 				}
 			}
-			else mapTexture->SetColorMod({ 100, 100, 100, 255 })->SetPosition(x + 5, y + (50 * i))->SetScale(1.2f);
+			else GetRenderer().DrawSprite(sheet, s, { x + 5, row }, 1.2f, { 100, 100, 100, 255 });
 		}
-		else mapTexture->SetColorMod({ 150, 150, 150, 150 })->SetPosition(x, y + (50 * i))->SetScale(1.4f);
-
-		mapTexture->Draw();
+		else GetRenderer().DrawSprite(sheet, s, { x, row }, 1.4f, { 150, 150, 150, 150 });
 	}
 
 	if (debugging) 
@@ -256,14 +278,12 @@ bool GoblinsMain::DrawTileOptions()
 
 	DrawSelectedObject();
 
-	map.ResetTexture();
-
 	return highLighting != -1 || DrawObjectOptions();
 }
 
 void GoblinsMain::HandlePlaceItems()
 {
-	Vec2 worldMouse = GetCamera() + InputManager::GetMouse();
+	Vec2 worldMouse = GetCameraObject()->ScreenToWorld(InputManager::GetMouse());
 
 	if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_RIGHT))
 	{
@@ -304,7 +324,12 @@ void GoblinsMain::HandlePlaceItems()
 
 					if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT) == false)
 						highlightSprite.SetColorMod(validPlacementColor);
-					else map.SetTile(id, 0);
+					else
+					{
+						// Clears whatever is built here too, workables drop out of the registry
+						map.SetObject(id, -1);
+						map.SetTile(id, 0);
+					}
 
 					highlightSprite.SetPosition(map.GetTilePos(id));
 					highlightSprite.DrawRelative(GetCameraObject());
@@ -320,12 +345,12 @@ void GoblinsMain::HandlePlaceItems()
 		if (tileTypeIndex < map.GetTileTypeCount())
 		{
 			// Place tiles
-			if (map.GetType(tileTypeIndex).GetBoolAttribute(MAP::MULTI_PLACE_ATT) == true)
+			if (map.GetInfo(tileTypeIndex).Has(MAP::TILE_MULTI))
 			{
 				lenX = finalCell.x - startCell.x;
 				lenY = finalCell.y - startCell.y;
 
-				if (map.GetType(tileTypeIndex).GetBoolAttribute(MAP::LINEAR_ATT) == true)
+				if (map.GetInfo(tileTypeIndex).Has(MAP::TILE_LINEAR))
 				{
 					if (abs(lenX) > abs(lenY)) lenY = 0; else lenX = 0;
 				}
@@ -360,25 +385,20 @@ void GoblinsMain::HandlePlaceItems()
 			int id = map.GetTile(finalCell.x, finalCell.y);
 			highlightSprite.SetPosition(map.GetTilePos(id));
 			Uint32 index = tileTypeIndex - map.GetTileTypeCount();
+			Color previewTint = Color::RED;
 
 			// Place items
 
 			if (CanPlace(map.GetType(map.GetTileLayer(id)), map.GetType(tileTypeIndex)))
 			{
-				if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT) == false)
-				{
-					highlightSprite.SetColorMod(validPlacementColor);
-					map.GetTexture(index)->SetColorMod(Color::WHITE);
-				}
+				if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT) == false) highlightSprite.SetColorMod(validPlacementColor);
 				else map.SetObject(id, index);
+
+				previewTint = Color::WHITE;
 			}
-			else
-			{
-				highlightSprite.SetColorMod(invalidPlacementColor);
-				map.GetTexture(index)->SetColorMod(Color::RED);
-			}
+			else highlightSprite.SetColorMod(invalidPlacementColor);
 
-			map.GetTexture(index)->SetPosition(map.GetTilePos(id))->DrawRelative(GetCameraObject());
+			GetRenderer().DrawSprite(map.GetObjectSheet(index), 0, map.GetTilePos(id), 1.0f, previewTint, false, true);
 			highlightSprite.DrawRelative(GetCameraObject());
 		}
 	}
@@ -386,12 +406,20 @@ void GoblinsMain::HandlePlaceItems()
 
 void GoblinsMain::HandlePickupItems() 
 {
-	Vec2 worldMouse = GetCamera() + InputManager::GetMouse();
+	Vec2 worldMouse = GetCameraObject()->ScreenToWorld(InputManager::GetMouse());
 
 	if (highlighting == true) return;
 
 	if (InputManager::GetMouseButtonUp(MOUSE_BUTTON::MB_LEFT))
 	{
+		// Goblins stand in front of the tiles, clicking one leaves what is under it alone
+		GoblinObj* goblin = PickGoblin(worldMouse, static_cast<float>(map.GetTileSize().x));
+		if (goblin != nullptr)
+		{
+			if (gobl::GoblEngine::debugging) std::cout << "Goblin-" << goblin->GetId() << " clicked" << std::endl;
+			return;
+		}
+
 		IntVec2 finalCell = map.GetTileMapPos(static_cast<int>(worldMouse.x), static_cast<int>(worldMouse.y));
 
 		if (finalCell.x != -1 && finalCell.y != -1) 
@@ -399,7 +427,7 @@ void GoblinsMain::HandlePickupItems()
 			// Clicked on a tile
 
 			int id = map.GetTile(finalCell.x, finalCell.y);
-			auto tile = map.GetType(map.GetObjectLayer(id) + map.GetTileTypeCount());
+			const MAP::TileData& tile = map.GetType(map.GetObjectLayer(id) + map.GetTileTypeCount());
 			if (tile.GetStrAttribute("onclick").length() > 0) 
 			{
 				luaMachine.RunScriptFunction((std::string("Mods/") + tile.GetStrAttribute("onclick")).c_str(), "onclick");
@@ -425,11 +453,13 @@ void GoblinsMain::HandlePickupItems()
 // Basic function
 bool GoblinsMain::Start()
 {
-	map = MAP::Map(this, 64, 64, "Mods/");
+	map = MAP::Map(this, 4096, 4096, "Mods/");
+	if (UsesSave() && std::filesystem::exists(SAVE_PATH)) map.Load(SAVE_PATH);
 	map.UpdateObjects();
 
 	CreateSpriteObject(highlightSprite, "Sprites/highlightTile.png");
 	highlightSprite.SetColorMod(Color::BLACK);
+	highlightSprite.SetLayer(LAYER_OVERLAY);
 	CreateSpriteObject(title, "Sprites/Title_HighRes.png");
 	title.SetScale(0.9f);
 
@@ -458,12 +488,6 @@ bool GoblinsMain::Start()
 	hireNewGoblin.SetScale(2.0f);
 	hireNewGoblin.SetAlpha(100);
 
-	// Calculate viewarea
-	std::cout << "Calculating viewport" << std::endl;
-	viewArea = map.GetTileMapPos(GetScreenWidth(), GetScreenHeight());
-	viewArea.x += 1;
-	viewArea.y += 2;
-
 	// Handle the audio
 	GetAudio()->PlayMusic();
 
@@ -477,23 +501,73 @@ bool GoblinsMain::Start()
 
 void GoblinsMain::DrawWorld(bool blur)
 {
-	IntVec2 cell = map.GetClosestTileMapPos(static_cast<int>(GetCamera().x), static_cast<int>(GetCamera().y));
+	// Exact tile range under the screen, follows zoom and rotation
+	SDL_FRect view = GetCameraObject()->GetVisibleRect();
+	IntVec2 tile = map.GetTileSize();
+	if (tile.x <= 0 || tile.y <= 0) return;
+
+	int x0 = static_cast<int>(std::floor(view.x / tile.x));
+	int y0 = static_cast<int>(std::floor(view.y / tile.y));
+	int x1 = static_cast<int>(std::floor((view.x + view.w) / tile.x));
+	int y1 = static_cast<int>(std::floor((view.y + view.h) / tile.y));
+
+	// Off the top left of the map, keep only the part that overlaps it
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 < x0 || y1 < y0) return;
+
+	Uint32 w = static_cast<Uint32>(x1 - x0 + 1);
+	Uint32 h = static_cast<Uint32>(y1 - y0 + 1);
 
-	if (blur == false) map.DrawRegion(viewArea.x, viewArea.y, cell.x, cell.y);
-	else map.BlurDrawRegion(viewArea.x, viewArea.y, cell.x, cell.y);
+	if (blur == false) map.DrawRegion(w, h, x0, y0);
+	else map.BlurDrawRegion(w, h, x0, y0);
 
 	//testSprite.SetPosition(map.GetEmptyWorkable(-1));
 	//testSprite.DrawRelative(GetCameraObject());
 }
 
+void GoblinsMain::FixedUpdate()
+{
+	// The world is paused behind menus and prompts
+	if (quittingApp || quitToMenu || currScene != Scene::Game) return;
+
+	// FIXME: Move map.UpdateObjects() to the end or start of a day
+	// DEBUG: This should update the map objects, 250 ticks is a little over 4 seconds
+	if (hour >= 250)
+	{
+		map.UpdateObjects();
+		hour = 0;
+	}
+
+	// FIXME: Make a time manager
+	hour++;
+
+	// Only the snapshot is taken here, the writing happens in the background
+	if (++autosaveTicks >= AUTOSAVE_TICKS)
+	{
+		SaveWorld();
+		autosaveTicks = 0;
+	}
+
+	// Goblin management
+	ProfileScope profile(PROFILE_GOBLINS);
+	for (unsigned int i = 0; i < goblins.size(); i++) 
+	{
+		goblins.at(i)->Update();
+	}
+}
+
 bool GoblinsMain::Update()
 {
 	auto mousePos = InputManager::GetMouse();
-	Vec2 worldMouse = GetCamera() + InputManager::GetMouse();
+	Vec2 worldMouse = GetCameraObject()->ScreenToWorld(InputManager::GetMouse());
 
 	bool blur = quitToMenu || currScene == Scene::MainMenu;
 	DrawWorld(blur);
 
+	// Menus and prompts pause the world, let the engine throttle while nobody touches them
+	SetSceneStatic(quittingApp || quitToMenu || currScene == Scene::MainMenu);
+
 	if (quittingApp)
 	{
 		bool cancelButton = false;
@@ -516,6 +590,7 @@ bool GoblinsMain::Update()
 		if (quitButton)
 		{
 			// FIXME: Unload non-menu content
+			SaveWorld();
 			currScene = Scene::MainMenu;
 			quitToMenu = false;
 		}
@@ -550,26 +625,13 @@ bool GoblinsMain::Update()
 
 	HandlePickupItems();
 
-	// FIXME: Move map.UpdateObjects() to the end or start of a day
-	// DEBUG: This should update the map objects
-	if (hour >= 250)
-	{
-		map.UpdateObjects();
-		hour = 0;
-	}
-
 	//if (InputManager::GetMouseButtonUp(1)) {
 	//	GetAudio()->PlaySound("Sounds/Blop.wav");
 	//}
 
-	// FIXME: Make a time manager
-	hour++;
-
-	// Goblin management
-	for (unsigned int i = 0; i < goblins.size(); i++) 
-	{
-		goblins.at(i)->Update();
-	}
+	// Goblins are simulated in FixedUpdate, blend between their last two ticks
+	float alpha = time.GetAlpha();
+	for (unsigned int i = 0; i < goblins.size(); i++) goblins.at(i)->Draw(alpha);
 
 	// FIXME: Use a hiring manager
 	// --Start goblin hiring process
@@ -638,6 +700,13 @@ bool GoblinsMain::Update()
 	if (InputManager::GetKey(SDLK_UP)) camMove.y -= spd * time.fDeltaTime;
 	if (InputManager::GetKey(SDLK_DOWN)) camMove.y += spd * time.fDeltaTime;
 
+	float rotSpd = 90.0f;
+	if (InputManager::GetKey(SDLK_q)) RotateCamera(-rotSpd * time.fDeltaTime);
+	if (InputManager::GetKey(SDLK_e)) RotateCamera(rotSpd * time.fDeltaTime);
+
+	// Drags and arrow keys are in screen space, move along the rotated view
+	camMove = GetCameraObject()->ScreenDeltaToWorld(camMove);
+
 	// Display the users money
 	std::string moneyStr = std::to_string(money);
 	auto num = money / 100;
@@ -651,7 +720,7 @@ bool GoblinsMain::Update()
 	DrawOutlinedString(moneyStr, 30, 4, 30, 3U);
 
 	MoveCamera(camMove.x, camMove.y);
-	//MoveZoom(InputManager::GetMouseWheel());
+	MoveZoom(InputManager::GetMouseWheel() * 0.1f);
 	//DrawOutlinedString(std::to_string(GetCameraObject()->zoom), 50, 90, 20, 3U);
 
 	return true;
@@ -12,6 +12,8 @@ enum Scene : Uint8
 	Paused = 2,
 };
 
+const char SAVE_PATH[] = "Saves/world.gmap";
+
 class GoblinsMain : public gobl::GoblEngine
 {
 public:
@@ -38,10 +40,6 @@ public:
 	bool quittingApp = false;
 	bool quitToMenu = false;
 
-	// FIXME: Load in the textures overtime instead of all at once
-	//int texturesLoaded = 0;
-	//const int texturesToLoad = 5;
-
 	// FIXME: Use a goblin manager
 	void HireGoblin();
 
@@ -57,11 +55,19 @@ public:
 
 private:
 	void Init() override { SetTitle("Goblins inc."); }
+	void Preload(gobl::AssetLoader& loader) override { MAP::Map::PreloadMods(loader, "Mods/"); }
 	bool Start() override;
+	void FixedUpdate() override;
 	bool Update() override;
 	void Draw(gobl::GoblRenderer& renderer) override;
+	// Headless runs are measured from a fresh map and must not touch the player's save
+	bool UsesSave() { return GetRenderer().IsHeadless() == false; }
+	void SaveWorld() { if (UsesSave()) map.Save(SAVE_PATH); }
+
 	bool Exit() override
 	{
+		// Destroy waits for the write to finish
+		SaveWorld();
 		map.Destroy();
 
 		return true;
@@ -4,13 +4,78 @@
 #include <iostream>
 #include <filesystem>
 #include <functional>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 
 namespace MAP
 {
+	namespace
+	{
+		struct NameTable
+		{
+			std::vector<std::string> names{};
+			std::unordered_map<std::string, AttributeId> ids{};
+
+			NameTable()
+			{
+				// Same order as KnownAttribute
+				for (const char* name : { "", SPRITE_ATT, PRICE_ATT, MULTI_PLACE_ATT, LINEAR_ATT, WORKABLE_ATT, COLLISION_ATT, GROWABLE_ATT,
+					LENGTH_ATT, RATE_ATT })
+				{
+					ids.emplace(name, static_cast<AttributeId>(names.size()));
+					names.push_back(name);
+				}
+			}
+		};
+
+		NameTable& GetNameTable()
+		{
+			static NameTable table{};
+			return table;
+		}
+	}
+
+	AttributeId AttributeNames::Intern(const std::string& name)
+	{
+		NameTable& table = GetNameTable();
+
+		auto id = table.ids.find(name);
+		if (id != table.ids.end()) return id->second;
+
+		AttributeId added = static_cast<AttributeId>(table.names.size());
+		table.ids.emplace(name, added);
+		table.names.push_back(name);
+
+		return added;
+	}
+
+	AttributeId AttributeNames::Find(const std::string& name)
+	{
+		NameTable& table = GetNameTable();
+
+		auto id = table.ids.find(name);
+		return id != table.ids.end() ? id->second : ATT_NONE;
+	}
+
+	const std::string& AttributeNames::GetName(AttributeId id)
+	{
+		NameTable& table = GetNameTable();
+		return id < table.names.size() ? table.names[id] : table.names[ATT_NONE];
+	}
+
 	const std::string TEXTURE_PATH = "Sprites/";
-	const std::string GROWABLE_TAG = "growable";
-	const std::string GROWTH_INDEX = "GrowthIndex";
-	const std::string LENGTH_TAG = "length";
+	const std::string LIGHT_TAG = "light";
+	const AttributeId LIGHT_ATT = AttributeNames::Intern(LIGHT_TAG);
+	const AttributeId LIGHT_RADIUS_ATT = AttributeNames::Intern("lightRadius");
+	const AttributeId LIGHT_R_ATT = AttributeNames::Intern("lightR");
+	const AttributeId LIGHT_G_ATT = AttributeNames::Intern("lightG");
+	const AttributeId LIGHT_B_ATT = AttributeNames::Intern("lightB");
+
+	// Chunks kept baked at once, the least recently drawn go first past this
+	const size_t MAX_BAKED_CHUNKS = 512;
+	// Tiles lit around the view so small pans don't recompute anything
+	const int LIGHT_MARGIN = 8;
 	bool MAP_DEBUG_VERBOSE = false;
 
 	IntVec2 sprSize{ 0,0 };
@@ -60,19 +125,43 @@ namespace MAP
 					continue;
 				}
 
+				// <light radius="5" r="255" g="200" b="120"> on objects that glow
+				if (elementName == LIGHT_TAG)
+				{
+					tileData.SetBoolAttribute(LIGHT_ATT, true);
+
+					try
+					{
+						int value = std::stoi(currAttValue);
+
+						if (currAttName == "radius") tileData.SetIntAttribute(LIGHT_RADIUS_ATT, value);
+						else if (currAttName == "r") tileData.SetIntAttribute(LIGHT_R_ATT, value);
+						else if (currAttName == "g") tileData.SetIntAttribute(LIGHT_G_ATT, value);
+						else if (currAttName == "b") tileData.SetIntAttribute(LIGHT_B_ATT, value);
+						else std::cout << "\t\tUnknown light attribute: " << currAttName << std::endl;
+					}
+					catch (std::exception&)
+					{
+						std::cout << "\t\tLight attribute " << currAttName << " is not a number: " << currAttValue << std::endl;
+					}
+
+					curAtt = curAtt->Next();
+					continue;
+				}
+
 				// FIXME: Refactor build layers to be clearer
 				if (currAttName == "layer")
 				{
 					if (elementName == "buildable")
 					{
-						tileData.buildLayer = currAttValue;
+						tileData.SetBuildLayer(currAttValue);
 
 						if (MAP_DEBUG_VERBOSE)
 							std::cout << "\t\tLayer attribute: " << tileData.buildLayer << std::endl;
 					}
 					else if (elementName == "placable")
 					{
-						tileData.layer = currAttValue;
+						tileData.SetLayer(currAttValue);
 
 						if (MAP_DEBUG_VERBOSE)
 							std::cout << "\t\tLayer attribute: " << tileData.layer << std::endl;
@@ -184,11 +273,49 @@ namespace MAP
 			currElement = currElement->NextSiblingElement();
 		}
 	}
+	// Mod files parsed ahead of time by PreloadMods, keyed by the path LoadModData is given
+	std::unordered_map<std::string, std::unique_ptr<tinyxml2::XMLDocument>> parsedMods{};
+	std::mutex parsedModsMutex{};
+
+	void Map::PreloadMods(gobl::AssetLoader& loader, const char* path)
+	{
+		for (const auto& file : std::filesystem::recursive_directory_iterator(path))
+		{
+			if (file.is_directory() || file.path().extension() != ".xml") continue;
+			std::string modPath = path + file.path().filename().string();
+
+			loader.QueueJob([modPath]()
+			{
+				auto doc = std::make_unique<tinyxml2::XMLDocument>();
+				if (doc->LoadFile(modPath.c_str()) != tinyxml2::XML_SUCCESS) return;
+
+				std::lock_guard<std::mutex> lock(parsedModsMutex);
+				parsedMods[modPath] = std::move(doc);
+			});
+		}
+	}
+
 	void Map::LoadModData(const char* path)
 	{
-		tinyxml2::XMLDocument doc;
-		doc.LoadFile(path);
-		tinyxml2::XMLElement* currElement = doc.FirstChildElement();
+		std::unique_ptr<tinyxml2::XMLDocument> doc{};
+
+		{
+			std::lock_guard<std::mutex> lock(parsedModsMutex);
+			auto it = parsedMods.find(path);
+			if (it != parsedMods.end())
+			{
+				doc = std::move(it->second);
+				parsedMods.erase(it);
+			}
+		}
+
+		if (doc == nullptr)
+		{
+			doc = std::make_unique<tinyxml2::XMLDocument>();
+			doc->LoadFile(path);
+		}
+
+		tinyxml2::XMLElement* currElement = doc->FirstChildElement();
 
 		while (currElement != nullptr) 
 		{
@@ -233,6 +360,13 @@ namespace MAP
 					curAtt = curAtt->Next();
 				}
 			}
+			else if (currName == "AmbientLight")
+			{
+				// World light level where no light reaches, white leaves the world unlit
+				ambient.r = static_cast<Uint8>(currElement->IntAttribute("r", 255));
+				ambient.g = static_cast<Uint8>(currElement->IntAttribute("g", 255));
+				ambient.b = static_cast<Uint8>(currElement->IntAttribute("b", 255));
+			}
 			else if (currName == "EnvironmentObject")
 			{
 				//std::cout << "Tile object found!" << std::endl;
@@ -246,14 +380,13 @@ namespace MAP
 				HandleObjElements(currElement, obj, texturePath);
 
 				// Push the object to the stack
-				obj.SetIntAttribute(SPRITE_ATT, static_cast<int>(objSprites.size()));
-				objSprites.push_back(new gobl::Sprite());
-				objSprites[obj.GetIntAttribute(SPRITE_ATT)] = ge->CreateSpriteObject(texturePath.c_str());
+				obj.SetIntAttribute(ATT_SPRITE, static_cast<int>(objSprites.size()));
+				objSprites.push_back(ge->CreateSpriteObject(texturePath.c_str()));
 
 				int dX = obj.GetIntAttribute("dimX");
 				int dY = obj.GetIntAttribute("dimY");
-				if (dX != 0 && dY != 0) objSprites[obj.GetIntAttribute(SPRITE_ATT)]->SetStaticDimensions(dX, dY);
-				else objSprites[obj.GetIntAttribute(SPRITE_ATT)]->SetStaticDimensions(sprSize.x, sprSize.y);
+				if (dX != 0 && dY != 0) objSprites[obj.info.sprite]->SetStaticDimensions(dX, dY);
+				else objSprites[obj.info.sprite]->SetStaticDimensions(sprSize.x, sprSize.y);
 
 				objects.push_back(obj);
 			}
@@ -263,12 +396,17 @@ namespace MAP
 	}
 
 	// Map stuff
-	Map::Map(gobl::GoblEngine* ge, int w, int h, const char* path) : ge(ge), width(w), height(h)
+	Map::Map(gobl::GoblEngine* ge, int w, int h, const char* path) : ge(ge)
 	{
-		mapLength = width * height;
-		mapLayers = new Uint32[mapLength];
-		objLayers = new Sint32[mapLength];
-		colMap = new bool[mapLength];
+		if (w < 1 || h < 1 || w > static_cast<int>(MAX_MAP_SIZE) || h > static_cast<int>(MAX_MAP_SIZE))
+			std::cout << "ERROR: A " << w << "x" << h << " map is outside 1-" << MAX_MAP_SIZE << " tiles a side, clamping it" << std::endl;
+
+		width = static_cast<Uint16>(std::clamp(w, 1, static_cast<int>(MAX_MAP_SIZE)));
+		height = static_cast<Uint16>(std::clamp(h, 1, static_cast<int>(MAX_MAP_SIZE)));
+		chunksX = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		chunksY = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		chunks.resize(chunksX * chunksY);
+		cells.resize(chunksX * chunksY);
 
 		// Load all the mods
 		std::cout << "Loading mods..." << std::endl;
@@ -292,157 +430,456 @@ namespace MAP
 
 		// Find all the items that can be spawned at the creation of the world
 		for (unsigned int i = 0; i < objects.size(); i++)
-			if (objects[i].GetBoolAttribute(GROWABLE_TAG)) initObjects.push_back(i);
+			if (objects[i].info.Has(TILE_GROWABLE)) initObjects.push_back(i);
 
-		// FIXME: Load old map data
-		for (Uint32 i = 0; i < mapLength; i++)
-		{
-			mapLayers[i] = 0;
-			objLayers[i] = initObjects[rand() % initObjects.size()];
+		// Saved worlds replace this through Load
+		// Only the start area is generated, the rest stays plain ground until something is built on it
+		Uint32 genW = std::min<Uint32>(width, GENERATED_AREA);
+		Uint32 genH = std::min<Uint32>(height, GENERATED_AREA);
 
-			if (objLayers[i] > 0 && objects[objLayers[i]].GetBoolAttribute(GROWABLE_TAG))
+		for (Uint32 y = 0; y < genH; y++)
+		{
+			for (Uint32 x = 0; x < genW; x++)
 			{
-				const char GROW_INDEX = objects[objLayers[i]].GetIntAttribute(LENGTH_TAG) - 1; // Allow the modder to specify the index
+				int object = initObjects[rand() % initObjects.size()];
+				if (object < 0) continue;
 
-				std::string growableName = GROWTH_INDEX + std::to_string(i);
-				objects[objLayers[i]].SetIntAttribute(growableName, rand() % GROW_INDEX);
-			}
+				Uint32 id = MakeId(x, y);
+				CellChunk& chunk = TouchChunk(id);
+				Uint32 c = CellOf(id);
+
+				chunk.objects[c] = object;
+				ResetCell(id);
 
-			colMap[i] = false;
+				// Start the world part grown
+				if (chunk.growthPeriod[c] != 0)
+				{
+					chunk.growthStage[c] = static_cast<Uint8>(rand() % (objects[object].info.growLength - 1));
+				}
+
+				UpdateLightSource(id);
+			}
 		}
 	}
 
-	void Map::ResetTexture() 
+	CellChunk& Map::TouchChunk(Uint32 id)
 	{
-		envTex->SetDimensions(sprSize);
-		envTex->SetColorMod(Color::WHITE);
+		std::unique_ptr<CellChunk>& chunk = cells[ChunkOf(id)];
 
-		for (auto& spr : objSprites)
+		if (chunk == nullptr)
 		{
-			spr->SetSpriteIndex(0);
-			spr->ResetDimensions();
-			spr->SetColorMod(Color::WHITE);
+			chunk = std::make_unique<CellChunk>();
+			liveChunks.push_back(ChunkOf(id));
+
+			// It no longer shares the plain ground texture
+			chunks[ChunkOf(id)].dirty = true;
+			revision++;
 		}
+
+		return *chunk;
 	}
 
-	void Map::DrawTile(Uint32 x, Uint32 y) 
+	void Map::DrawTile(Uint32 x, Uint32 y, IntVec2 origin, bool relative)
 	{
-		Uint64 i = y * width + x;
-
-		// FIXME: Implement lights
+		Uint32 i = MakeId(x, y);
+		const CellChunk* chunk = FindChunk(i);
+		Uint32 c = CellOf(i);
+		gobl::GoblRenderer& renderer = ge->GetRenderer();
+		IntVec2 tileSize = envTex->GetScale();
+		IntVec2 pos{ tileSize.x * static_cast<int>(x) - origin.x, tileSize.y * static_cast<int>(y) - origin.y };
 
 		// Draw tiles
-		envTex->SetSpriteIndex(GetType(mapLayers[i]).GetIntAttribute(SPRITE_ATT));
-		envTex->SetPosition(envTex->GetScale().x * x, envTex->GetScale().y * y);
+		bool collision = chunk != nullptr && chunk->collision[c];
+		Color tint = Color::WHITE;
+		if (gobl::GoblEngine::debugging) tint = collision ? Color::RED : Color::LIGHT_BLUE;
+
+		renderer.DrawSprite(envTex->GetSpriteHandle(), GetInfo(chunk != nullptr ? chunk->tiles[c] : 0).sprite, pos, 1.0f, tint, false,
+			relative, gobl::LAYER_GROUND);
 
-		if (gobl::GoblEngine::debugging) 
+		// Draw items
+		// FIXME: Move "objects" over to Objects with positions instead of being pure data in an array
+		if (chunk != nullptr && chunk->objects[c] >= 0)
 		{
-			if (colMap[i]) envTex->SetColorMod(Color::RED);
-			else envTex->SetColorMod(Color::LIGHT_BLUE);
+			const TileData& obj = objects[chunk->objects[c]];
+			int frame = 0;
+
+			Color objTint = Color::WHITE;
+			if (gobl::GoblEngine::debugging && obj.info.Has(TILE_WORKABLE)) objTint = Color::GREEN;
+
+			// The sheet runs from fully grown to freshly planted
+			if (obj.info.Has(TILE_GROWABLE)) frame = std::max(obj.info.growLength - 1 - chunk->growthStage[c], 0);
+
+			renderer.DrawSprite(objSprites[obj.info.sprite]->GetSpriteHandle(), frame, pos, 1.0f, objTint, false, relative, gobl::LAYER_OBJECTS);
 		}
+	}
+
+	// DEPRECATED: Far too inefficient to be worth using
+	void Map::Draw()
+	{
+		for (Uint32 y = 0; y < height; y++)
+			for (Uint32 x = 0; x < width; x++)
+				DrawTile(x, y);
+	}
 
-		envTex->DrawRelative(ge->GetCameraObject());
+	void Map::InvalidateTile(Uint32 index)
+	{
+		if (chunks.empty() || IsValidId(index) == false) return;
 
-		// Draw items
-		// FIXME: Move "objects" over to Objects with positions instead of being pure data in an array
-		if (objLayers[i] >= 0)
+		chunks[ChunkOf(index)].dirty = true;
+		revision++;
+	}
+
+	void Map::BakeChunk(Uint32 cx, Uint32 cy)
+	{
+		MapChunk& chunk = chunks[cy * chunksX + cx];
+		gobl::GoblRenderer& renderer = ge->GetRenderer();
+		IntVec2 scale = envTex->GetScale();
+
+		if (chunk.textureId == -1)
 		{
-			Uint32 sprIndex = objects[objLayers[i]].GetIntAttribute(SPRITE_ATT);
+			chunk.textureId = renderer.CreateRenderTarget(scale.x * CHUNK_SIZE, scale.y * CHUNK_SIZE);
+			if (chunk.textureId == -1) return;
 
-			if (gobl::GoblEngine::debugging && objects[objLayers[i]].GetBoolAttribute(WORKABLE_ATT)) 
-				objSprites[sprIndex]->SetColorMod(Color::GREEN);
-			else objSprites[sprIndex]->SetColorMod(Color::WHITE);
+			bakedChunks.push_back(cy * chunksX + cx);
+		}
 
-			if (objects[objLayers[i]].GetBoolAttribute(GROWABLE_TAG))
-			{
-				const char GROW_INDEX = objects[objLayers[i]].GetIntAttribute(LENGTH_TAG) - 1; // Allow the modder to specify the index
+		IntVec2 origin{ static_cast<int>(cx * CHUNK_SIZE) * scale.x, static_cast<int>(cy * CHUNK_SIZE) * scale.y };
 
-				std::string growableName = GROWTH_INDEX + std::to_string(i);
-				int growableIndex = objects[objLayers[i]].GetIntAttribute(growableName);
+		renderer.BeginTarget(chunk.textureId);
 
-				objSprites[sprIndex]->SetSpriteIndex(GROW_INDEX - growableIndex);
-			}
+		for (Uint32 y = cy * CHUNK_SIZE; y < (cy + 1) * CHUNK_SIZE && y < height; y++)
+			for (Uint32 x = cx * CHUNK_SIZE; x < (cx + 1) * CHUNK_SIZE && x < width; x++)
+				DrawTile(x, y, origin, false);
 
-			objSprites[sprIndex]->SetPosition(envTex->GetScale().x * x, envTex->GetScale().y * y);
-			objSprites[sprIndex]->DrawRelative(ge->GetCameraObject());
+		renderer.EndTarget();
+
+		chunk.dirty = false;
+	}
+
+	void Map::BakePlainChunk()
+	{
+		gobl::GoblRenderer& renderer = ge->GetRenderer();
+		IntVec2 scale = envTex->GetScale();
+
+		if (plainChunk.textureId == -1)
+		{
+			plainChunk.textureId = renderer.CreateRenderTarget(scale.x * CHUNK_SIZE, scale.y * CHUNK_SIZE);
+			if (plainChunk.textureId == -1) return;
 		}
+
+		Color tint = gobl::GoblEngine::debugging ? Color::LIGHT_BLUE : Color::WHITE;
+
+		renderer.BeginTarget(plainChunk.textureId);
+
+		for (Uint32 y = 0; y < CHUNK_SIZE; y++)
+			for (Uint32 x = 0; x < CHUNK_SIZE; x++)
+				renderer.DrawSprite(envTex->GetSpriteHandle(), GetInfo(0).sprite, { static_cast<int>(x) * scale.x, static_cast<int>(y) * scale.y },
+					1.0f, tint, false, false, gobl::LAYER_GROUND);
+
+		renderer.EndTarget();
+
+		plainChunk.dirty = false;
 	}
 
-	// DEPRECATED: Far too inefficient to be worth using
-	void Map::Draw()
+	void Map::EvictChunks()
 	{
-		for (size_t i = 0; i < mapLength; i++)
+		if (bakedChunks.size() <= MAX_BAKED_CHUNKS) return;
+
+		// Anything not on screen this frame can be baked again when it comes back
+		for (size_t i = 0; i < bakedChunks.size();)
 		{
-			int x = i % width;
-			int y = i / width;
+			MapChunk& chunk = chunks[bakedChunks[i]];
 
-			DrawTile(x, y);
+			if (chunk.lastDrawn == drawFrame) { i++; continue; }
+
+			gobl::TextureManager::DestroyTexture(chunk.textureId);
+			chunk.textureId = -1;
+			chunk.dirty = true;
+
+			bakedChunks[i] = bakedChunks.back();
+			bakedChunks.pop_back();
 		}
 	}
 
 	void Map::DrawRegion(Uint32 w, Uint32 h, int offX, int offY)
 	{
-		ResetTexture();
+		gobl::ProfileScope profile(gobl::PROFILE_MAP);
 		if (offX < 0) offX = 0;
 		if (offY < 0) offY = 0;
+		if (w == 0 || h == 0 || chunks.empty()) return;
 
-		for (Uint32 x = offX; x < offX + w; x++)
+		// Debug tints are baked into the chunks
+		if (chunksDebug != gobl::GoblEngine::debugging)
 		{
-			if (x >= width) continue;
+			chunksDebug = gobl::GoblEngine::debugging;
+			InvalidateChunks();
+		}
+
+		BakeRegion(w, h, offX, offY);
+		QueueRegion(w, h, offX, offY);
+		EvictChunks();
+	}
 
-			for (Uint32 y = offY; y < offY + h; y++)
+	void Map::BakeRegion(Uint32 w, Uint32 h, int offX, int offY)
+	{
+		Uint32 cx1 = std::min((offX + w - 1) / CHUNK_SIZE, chunksX - 1);
+		Uint32 cy1 = std::min((offY + h - 1) / CHUNK_SIZE, chunksY - 1);
+
+		for (Uint32 cy = offY / CHUNK_SIZE; cy <= cy1; cy++)
+		{
+			for (Uint32 cx = offX / CHUNK_SIZE; cx <= cx1; cx++)
 			{
-				if (y >= height) continue;
+				if (IsPlainChunk(cx, cy))
+				{
+					if (plainChunk.dirty) BakePlainChunk();
+				}
+				else if (chunks[cy * chunksX + cx].dirty) BakeChunk(cx, cy);
+			}
+		}
+	}
 
-				DrawTile(x, y);
+	void Map::QueueRegion(Uint32 w, Uint32 h, int offX, int offY)
+	{
+		IntVec2 scale = envTex->GetScale();
+		int chunkW = scale.x * CHUNK_SIZE;
+		int chunkH = scale.y * CHUNK_SIZE;
+
+		Uint32 cx1 = std::min((offX + w - 1) / CHUNK_SIZE, chunksX - 1);
+		Uint32 cy1 = std::min((offY + h - 1) / CHUNK_SIZE, chunksY - 1);
+		drawFrame++;
+
+		for (Uint32 cy = offY / CHUNK_SIZE; cy <= cy1; cy++)
+		{
+			for (Uint32 cx = offX / CHUNK_SIZE; cx <= cx1; cx++)
+			{
+				MapChunk& chunk = IsPlainChunk(cx, cy) ? plainChunk : chunks[cy * chunksX + cx];
+				chunk.lastDrawn = drawFrame;
+				if (chunk.textureId == -1) continue;
+
+				gobl::RenderObject ro{};
+				ro.textureId = chunk.textureId;
+				ro.sprRect = { 0, 0, chunkW, chunkH };
+				ro.rect = { static_cast<int>(cx) * chunkW, static_cast<int>(cy) * chunkH, chunkW, chunkH };
+				ro.layer = gobl::LAYER_GROUND;
+				ro.padded = false;
+
+				// World rect, the renderer applies camera zoom and rotation
+				gobl::RenderCommand command(ro);
+				command.flags |= gobl::RENDER_CAMERA;
+				ge->GetRenderer().QueueCommand(command);
 			}
 		}
+
+		DrawLighting({ offX, offY, static_cast<int>(w), static_cast<int>(h) });
 	}
 
 	void Map::BlurDrawRegion(Uint32 w, Uint32 h, int offX, int offY)
 	{
-		// FIXME: Actually blur the region please
-		DrawRegion(w, h, offX, offY);
+		const int BLUR_DOWNSAMPLE = 4;
+		const int BLUR_RADIUS = 2;
+
+		gobl::ProfileScope profile(gobl::PROFILE_MAP);
+		gobl::GoblRenderer& renderer = ge->GetRenderer();
+		if (offX < 0) offX = 0;
+		if (offY < 0) offY = 0;
+		if (w == 0 || h == 0 || chunks.empty()) return;
+
+		int screenW = static_cast<int>(ge->GetScreenWidth());
+		int screenH = static_cast<int>(ge->GetScreenHeight());
+		int blurW = std::max(1, screenW / BLUR_DOWNSAMPLE);
+		int blurH = std::max(1, screenH / BLUR_DOWNSAMPLE);
+
+		if (blurTarget == -1) blurTarget = renderer.CreateRenderTarget(blurW, blurH);
+		if (blurTexture == -1) blurTexture = renderer.CreateBlankTexture(blurW, blurH);
+		if (blurTarget == -1 || blurTexture == -1)
+		{
+			DrawRegion(w, h, offX, offY);
+			return;
+		}
+
+		gobl::CameraTransform view = ge->GetCameraObject()->GetTransform();
+		SDL_Rect region{ offX, offY, static_cast<int>(w), static_cast<int>(h) };
+
+		bool stale = blurRevision != revision || view.posX != blurView.posX || view.posY != blurView.posY || view.zoom != blurView.zoom ||
+			view.cos != blurView.cos || view.sin != blurView.sin || SDL_RectEquals(&region, &blurRegion) == SDL_FALSE;
+
+		if (stale)
+		{
+			// Chunks bake into targets of their own, so do that before taking over the target
+			BakeRegion(w, h, offX, offY);
+
+			renderer.BeginTarget(blurTarget, 1.0f / BLUR_DOWNSAMPLE);
+			QueueRegion(w, h, offX, offY);
+			renderer.EndTarget();
+
+			renderer.BlurTarget(blurTarget, blurTexture, BLUR_RADIUS);
+
+			blurRevision = revision;
+			blurView = view;
+			blurRegion = region;
+		}
+
+		// The whole world is a single quad until something changes
+		gobl::RenderObject ro{};
+		ro.textureId = blurTexture;
+		ro.sprRect = { 0, 0, blurW, blurH };
+		ro.rect = { 0, 0, screenW, screenH };
+		ro.layer = gobl::LAYER_GROUND;
+		ro.padded = false;
+		renderer.QueueTexture(ro);
+	}
+
+	void TimerWheel::Reset(Uint32 tick)
+	{
+		for (auto& level : slots)
+			for (auto& slot : level) slot.clear();
+
+		now = tick;
+		count = 0;
+	}
+
+	void TimerWheel::Schedule(Uint32 id, Uint32 due)
+	{
+		Insert({ id, due });
+		count++;
+	}
+
+	void TimerWheel::Insert(const Timer& timer)
+	{
+		Uint32 delta = timer.due - now;
+
+		// The level is the first whose slots are coarse enough to reach the tick
+		Uint32 level = 0;
+		while (level < LEVELS - 1 && delta >= (1u << (SLOT_BITS * (level + 1)))) level++;
+
+		slots[level][(timer.due >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(timer);
+	}
+
+	void TimerWheel::Advance(std::vector<Uint32>& due)
+	{
+		now++;
+
+		// Each time a level wraps, the next slot up is now close enough to spread over the levels below
+		for (Uint32 level = 1; level < LEVELS; level++)
+		{
+			if ((now & ((1u << (SLOT_BITS * level)) - 1)) != 0) break;
+
+			std::vector<Timer>& slot = slots[level][(now >> (SLOT_BITS * level)) & (SLOTS - 1)];
+			cascading.swap(slot);
+			for (auto& timer : cascading) Insert(timer);
+			cascading.clear();
+		}
+
+		std::vector<Timer>& slot = slots[0][now & (SLOTS - 1)];
+		for (auto& timer : slot) due.push_back(timer.id);
+		count -= slot.size();
+		slot.clear();
 	}
 
 	void Map::UpdateObjects() 
 	{
-		for (Uint32 x = 0; x < width; x++)
+		dueCells.clear();
+		growthWheel.Advance(dueCells);
+
+		// Only cells reaching a new frame this tick are touched, stale entries no longer match their cell
+		for (Uint32 index : dueCells)
 		{
-			for (Uint32 y = 0; y < height; y++)
-			{
-				Uint64 i = y * width + x;
+			CellChunk* chunk = FindChunk(index);
+			Uint32 c = CellOf(index);
 
-				// Update items
-				// FIXME: Move "objects" over to Objects with positions instead of being pure data in an array
-				if (objLayers[i] >= 0)
-				{
-					// FIXME: Find a better way to update growables than one at a time
-					if (objects[objLayers[i]].GetBoolAttribute(GROWABLE_TAG))
-					{
-						const char GROW_INDEX = objects[objLayers[i]].GetIntAttribute(LENGTH_TAG) - 1; // Allow the modder to specify the index
+			if (chunk != nullptr && chunk->growthPeriod[c] != 0 && chunk->growthDue[c] == growthWheel.GetNow()) AdvanceGrowth(index);
+		}
+	}
 
-						std::string growableName = GROWTH_INDEX + std::to_string(i);
-						int growableIndex = objects[objLayers[i]].GetIntAttribute(growableName);
+	void Map::AdvanceGrowth(Uint32 index)
+	{
+		CellChunk& chunk = *cells[ChunkOf(index)];
+		Uint32 c = CellOf(index);
 
-						if (growableIndex < GROW_INDEX)
-						{
-							std::string growthName = "growth" + std::to_string(i);
-							int growthIndex = objects[objLayers[i]].GetIntAttribute(growthName);
+		chunk.growthStage[c]++;
 
-							if (growthIndex >= objects[objLayers[i]].GetIntAttribute("rate")) // Allow the modder to specify the growth rate
-							{
-								objects[objLayers[i]].SetIntAttribute(growableName, growableIndex + 1);
-								objects[objLayers[i]].SetIntAttribute(growthName, 0);
+		if (chunk.growthStage[c] >= objects[chunk.objects[c]].info.growLength - 1) chunk.growthPeriod[c] = 0;
+		else ScheduleGrowth(index);
 
-								if (growableIndex + 1 >= GROW_INDEX) objects[objLayers[i]].ClearIntAttribute(growthName);
-							}
-							else objects[objLayers[i]].SetIntAttribute(growthName, growthIndex + 1);
-						}
-					}
-				}
+		InvalidateTile(index);
+	}
+
+	void Map::ScheduleGrowth(Uint32 index)
+	{
+		CellChunk& chunk = *cells[ChunkOf(index)];
+		Uint32 c = CellOf(index);
+
+		chunk.growthDue[c] = growthWheel.GetNow() + chunk.growthPeriod[c];
+		growthWheel.Schedule(index, chunk.growthDue[c]);
+	}
+
+	void Map::ResetCell(Uint32 index)
+	{
+		CellChunk* chunk = FindChunk(index);
+		if (chunk == nullptr) return;
+
+		Uint32 c = CellOf(index);
+		chunk->growthStage[c] = 0;
+		chunk->growthDue[c] = 0;
+		chunk->growthPeriod[c] = 0;
+		chunk->inUse[c] = 0;
+		chunk->owner[c] = -1;
+
+		if (chunk->objects[c] < 0) return;
+
+		// Allow the modder to specify the frame count and growth rate
+		const TileInfo& info = objects[chunk->objects[c]].info;
+		if (info.Has(TILE_GROWABLE) && info.growLength > 1)
+		{
+			chunk->growthPeriod[c] = static_cast<Uint16>(std::clamp(info.growRate + 1, 1, 0xFFFF));
+			ScheduleGrowth(index);
+		}
+	}
+
+	void Map::BenchmarkObjects(Uint16 size, int iterations, int rate)
+	{
+		size = static_cast<Uint16>(std::clamp<Uint32>(size, 1, MAX_MAP_SIZE));
+
+		Map map{};
+		map.width = map.height = size;
+		map.chunksX = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		map.chunksY = map.chunksX;
+		map.chunks.resize(map.chunksX * map.chunksY);
+		map.cells.resize(map.chunksX * map.chunksY);
+
+		TileData crop{};
+		crop.SetBoolAttribute(ATT_GROWABLE, true);
+		crop.SetIntAttribute(ATT_LENGTH, 255);
+		crop.SetIntAttribute(ATT_RATE, rate);
+		map.objects.push_back(crop);
+
+		// Every chunk is live, the worst case for a map this size
+		for (Uint32 y = 0; y < size; y++)
+		{
+			for (Uint32 x = 0; x < size; x++)
+			{
+				Uint32 id = map.MakeId(x, y);
+				map.TouchChunk(id).objects[CellOf(id)] = 0;
+				map.ResetCell(id);
 			}
 		}
+
+		std::cout << "Object update benchmark " << size << "x" << size << ", rate " << rate << ", " << iterations << " iterations" << std::endl;
+
+		Uint64 events = 0;
+		Uint64 start = SDL_GetPerformanceCounter();
+		for (int n = 0; n < iterations; n++)
+		{
+			map.UpdateObjects();
+			events += map.dueCells.size();
+		}
+		double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency() / iterations;
+
+		// Cost follows the cells that grew, not the map size
+		std::cout << "\tUpdateObjects: " << ms << "ms, " << static_cast<double>(events) / iterations << " growth events per tick, "
+			<< events / (ms * iterations * 1000.0) << "M events/s" << std::endl;
+
+		map.Destroy();
 	}
 
 	// ---------- Accessors  ---------------
@@ -451,38 +888,36 @@ namespace MAP
 	{
 		IntVec2 scale = envTex->GetScale();
 
-		int tileX = scale.x * (id % width);
-		int tileY = scale.y * (id / width);
+		IntVec2 cell = GetCellPos(id);
+		int tileX = scale.x * cell.x;
+		int tileY = scale.y * cell.y;
 
 		return (y >= tileY && y <= tileY + scale.y) && (x >= tileX && x <= tileX + scale.y);
 	}
 
 	int Map::GetTile(int x, int y)
 	{
-		if (x > width || x < 0) return -1;
-		if (y > height || y < 0) return -1;
+		if (x >= width || x < 0) return -1;
+		if (y >= height || y < 0) return -1;
 
-		return y * width + x;
+		return MakeId(x, y);
 	}
 
 	int Map::GetTileFromWorldPos(int x, int y)
 	{
-		if (x > width * envTex->GetScale().x || x < 0) return -1;
-		if (y > height * envTex->GetScale().y || y < 0) return -1;
-
-		x -= x % envTex->GetScale().x;
-		y -= y % envTex->GetScale().y;
+		if (x >= width * envTex->GetScale().x || x < 0) return -1;
+		if (y >= height * envTex->GetScale().y || y < 0) return -1;
 
 		x /= envTex->GetScale().x;
 		y /= envTex->GetScale().y;
 
-		return y * width + x;
+		return MakeId(x, y);
 	}
 
 	IntVec2 Map::GetTileMapPos(int x, int y)
 	{
-		if (x > width * envTex->GetScale().x || x < 0) return IntVec2{ -1, -1 };
-		if (y > height * envTex->GetScale().y || y < 0) return IntVec2{ -1, -1 };
+		if (x >= width * envTex->GetScale().x || x < 0) return IntVec2{ -1, -1 };
+		if (y >= height * envTex->GetScale().y || y < 0) return IntVec2{ -1, -1 };
 
 		x -= x % envTex->GetScale().x;
 		y -= y % envTex->GetScale().y;
@@ -506,70 +941,335 @@ namespace MAP
 
 	IntVec2 Map::GetTilePos(int id)
 	{
-		return { envTex->GetScale().x * (id % width), envTex->GetScale().y * (id / width) };
+		if (IsValidId(id) == false) return IntVec2{ -1, -1 };
+
+		IntVec2 cell = GetCellPos(id);
+		return { envTex->GetScale().x * cell.x, envTex->GetScale().y * cell.y };
 	}
 
 	int Map::GetEmptyWorkable() 
 	{
-		// Find an available workable
-		for (auto& o : workables)
-		{
-			if (objects[objLayers[o]].GetBoolAttribute(WORKABLE_ATT) == false) continue;
-			if (objects[objLayers[o]].GetBoolAttribute("inUse") == false) return o;
-		}
+		for (auto& free : freeWorkables)
+			if (free.empty() == false) return free.back();
 
 		return -1;
 	}
 
 	IntVec2 Map::GetWorkable(int id) 
 	{
-		if (id != -1) 
+		if (id == -1 || workables.count(id) == 0) return IntVec2{ 0, 0 };
+
+		return GetTilePos(id);
+	}
+
+	int Map::ClaimWorkable(Sint32 owner, Sint32 type)
+	{
+		int id = -1;
+
+		if (type < 0) id = GetEmptyWorkable();
+		else if (type < static_cast<Sint32>(freeWorkables.size()) && freeWorkables[type].empty() == false) id = freeWorkables[type].back();
+
+		if (id != -1) SetInUse(id, true, owner);
+
+		return id;
+	}
+
+	bool Map::ReleaseWorkable(Uint32 id, Sint32 owner)
+	{
+		if (workables.count(id) == 0 || IsInUse(id) == false || GetOwner(id) != owner) return false;
+
+		SetInUse(id, false);
+		return true;
+	}
+
+	// --------- Mutators -----------------
+
+	void Map::SetObject(Uint32 id, Sint32 index)
+	{
+		if (IsValidId(id) == false) return;
+
+		// Clearing plain ground leaves it plain
+		if (index < 0 && FindChunk(id) == nullptr) return;
+
+		// Whoever had the old workable here loses it
+		UnregisterWorkable(id);
+
+		TouchChunk(id).objects[CellOf(id)] = index;
+		ResetCell(id);
+
+		if (index >= 0 && objects[index].info.Has(TILE_WORKABLE)) RegisterWorkable(id, index);
+		InvalidateTile(id);
+		UpdateLightSource(id);
+	};
+
+	void Map::SetTile(int id, Uint32 index)
+	{
+		if (IsValidId(id) == false) return;
+
+		// Plain ground stays unallocated
+		if (index == 0 && FindChunk(id) == nullptr) return;
+
+		// FIXME: GetType is returning a tile not an object
+		CellChunk& chunk = TouchChunk(id);
+		Uint32 c = CellOf(id);
+		chunk.tiles[c] = index;
+
+		if (chunk.objects[c] >= 0) 
 		{
-			// Check for if the workable is currently in use
-			if (objects[objLayers[id]].GetBoolAttribute("inUse") == false) return GetTilePos(id);
+			const TileData& t = GetType(chunk.objects[c] + GetTileTypeCount());
+			if (t.info.layer != ATT_NONE && t.info.layer != GetInfo(index).buildLayer)
+				SetObject(id, -1); // FIXME: Provide a refund for items that cost money
+			else std::cout << t.name << " is valid placement: " << t.buildLayer << " " << GetType(index).layer << std::endl;
 		}
 
-		// Find an available workable
-		for (auto& o : workables)
+		SetCollision(id, GetInfo(index).Has(TILE_COLLISION));
+	}
+
+	void Map::SetCollision(Uint32 index, bool value)
+	{
+		if (IsValidId(index) == false) return;
+		if (value == false && FindChunk(index) == nullptr) return;
+
+		bool& collision = TouchChunk(index).collision[CellOf(index)];
+		if (collision != value) InvalidateLight(index, maxLightRadius);
+
+		collision = value;
+		InvalidateTile(index);
+	}
+
+	void Map::SetInUse(Uint32 id, bool value, Sint32 user)
+	{
+		if (IsValidId(id) == false) return;
+
+		CellChunk& chunk = TouchChunk(id);
+		Uint32 c = CellOf(id);
+
+		// Workables leave or rejoin their free list with it
+		auto workable = workables.find(id);
+		if (workable != workables.end() && (chunk.inUse[c] != 0) != value)
 		{
-			if (objects[objLayers[o]].GetBoolAttribute(WORKABLE_ATT) == false) continue;
-			if (objects[objLayers[o]].GetBoolAttribute("inUse") == false) 
-				return IntVec2{ (Sint32(o) % width) * envTex->GetScale().x , (Sint32(o) / width) * envTex->GetScale().y };
+			if (value) TakeFreeWorkable(workable->second);
+			else PutFreeWorkable(id, workable->second);
 		}
 
-		return IntVec2{ 0, 0 };
+		chunk.inUse[c] = value;
+		chunk.owner[c] = value ? user : -1;
 	}
 
-	// --------- Mutators -----------------
+	// --------- Workables -----------------
 
-	void Map::SetObject(Uint32 id, Sint32 index)
+	void Map::RegisterWorkable(Uint32 id, Sint32 type)
+	{
+		if (static_cast<size_t>(type) >= freeWorkables.size()) freeWorkables.resize(type + 1);
+
+		WorkableSlot& slot = workables[id];
+		slot.type = type;
+		slot.freeIndex = -1;
+
+		if (IsInUse(id) == false) PutFreeWorkable(id, slot);
+	}
+
+	void Map::UnregisterWorkable(Uint32 id)
+	{
+		auto workable = workables.find(id);
+		if (workable == workables.end()) return;
+
+		if (workable->second.freeIndex != -1) TakeFreeWorkable(workable->second);
+		workables.erase(workable);
+	}
+
+	void Map::TakeFreeWorkable(WorkableSlot& slot)
+	{
+		std::vector<Uint32>& free = freeWorkables[slot.type];
+
+		// Swap the last free one into the gap
+		Uint32 last = free.back();
+		free[slot.freeIndex] = last;
+		workables[last].freeIndex = slot.freeIndex;
+		free.pop_back();
+
+		slot.freeIndex = -1;
+	}
+
+	void Map::PutFreeWorkable(Uint32 id, WorkableSlot& slot)
+	{
+		std::vector<Uint32>& free = freeWorkables[slot.type];
+
+		slot.freeIndex = static_cast<Sint32>(free.size());
+		free.push_back(id);
+	}
+
+	void Map::InvalidateLight(Uint32 index, int radius)
+	{
+		if (IsValidId(index) == false) return;
+
+		IntVec2 cell = GetCellPos(index);
+		int x = cell.x;
+		int y = cell.y;
+		SDL_Rect area{ x - radius, y - radius, radius * 2 + 1, radius * 2 + 1 };
+		SDL_Rect bounds{ 0, 0, width, height };
+		if (SDL_IntersectRect(&area, &bounds, &area) == SDL_FALSE) return;
+
+		if (lightDirty.w == 0 || lightDirty.h == 0) lightDirty = area;
+		else SDL_UnionRect(&lightDirty, &area, &lightDirty);
+
+		revision++;
+	}
+
+	void Map::UpdateLightSource(Uint32 index)
 	{
-		if (index >= 0 && objects[index].GetBoolAttribute(WORKABLE_ATT))
+		// Drop the light that used to be here
+		for (size_t i = 0; i < lights.size(); i++)
 		{
-			workables.push_back(id);
+			if (lights[i].index != index) continue;
+
+			InvalidateLight(index, lights[i].radius);
+			lights[i] = lights.back();
+			lights.pop_back();
+			break;
 		}
-		else
+
+		if (GetObjectLayer(index) < 0) return;
+
+		const TileData& obj = objects[GetObjectLayer(index)];
+		if (obj.GetBoolAttribute(LIGHT_ATT) == false) return;
+
+		LightSource light{};
+		light.index = index;
+		light.x = GetCellPos(index).x;
+		light.y = GetCellPos(index).y;
+		light.radius = std::max(1, obj.GetIntAttribute(LIGHT_RADIUS_ATT));
+		light.r = static_cast<Uint8>(std::clamp(obj.GetIntAttribute(LIGHT_R_ATT), 0, 255));
+		light.g = static_cast<Uint8>(std::clamp(obj.GetIntAttribute(LIGHT_G_ATT), 0, 255));
+		light.b = static_cast<Uint8>(std::clamp(obj.GetIntAttribute(LIGHT_B_ATT), 0, 255));
+
+		lights.push_back(light);
+		maxLightRadius = std::max(maxLightRadius, light.radius);
+		InvalidateLight(index, light.radius);
+	}
+
+	bool Map::HasLineOfSight(int x0, int y0, int x1, int y1)
+	{
+		// Walk the tiles between the two, the end tiles themselves never block
+		int dx = std::abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+		int dy = -std::abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+		int err = dx + dy;
+
+		while (true)
 		{
-			// FIXME: if finds workable in list, remove it
+			int e2 = 2 * err;
+			if (e2 >= dy) { err += dy; x0 += sx; }
+			if (e2 <= dx) { err += dx; y0 += sy; }
+
+			if (x0 == x1 && y0 == y1) return true;
+			if (GetCollision(MakeId(x0, y0))) return false;
 		}
+	}
 
-		objLayers[id] = index;
-	};
+	void Map::UpdateLighting()
+	{
+		// Dirt outside the window is picked up when the window moves over it
+		SDL_Rect area{};
+		if (SDL_IntersectRect(&lightDirty, &lightWindow, &area) == SDL_FALSE)
+		{
+			lightDirty = {};
+			return;
+		}
 
-	void Map::SetTile(int id, Uint32 index)
+		for (int y = area.y; y < area.y + area.h; y++)
+		{
+			for (int x = area.x; x < area.x + area.w; x++)
+			{
+				int r = ambient.r, g = ambient.g, b = ambient.b;
+
+				for (auto& light : lights)
+				{
+					int d2 = (x - light.x) * (x - light.x) + (y - light.y) * (y - light.y);
+					if (d2 > light.radius * light.radius) continue;
+					if ((x != light.x || y != light.y) && HasLineOfSight(light.x, light.y, x, y) == false) continue;
+
+					// Smooth falloff to nothing just past the radius
+					float f = 1.0f - std::sqrt(static_cast<float>(d2)) / (light.radius + 1);
+					f *= f;
+
+					r += static_cast<int>(light.r * f);
+					g += static_cast<int>(light.g * f);
+					b += static_cast<int>(light.b * f);
+				}
+
+				lightMap[(y - lightWindow.y) * lightWindow.w + (x - lightWindow.x)] = ColorFromRGB(static_cast<Uint8>(std::min(r, 255)),
+					static_cast<Uint8>(std::min(g, 255)), static_cast<Uint8>(std::min(b, 255)));
+			}
+		}
+
+		if (lightTexture != -1)
+		{
+			SDL_Rect local{ area.x - lightWindow.x, area.y - lightWindow.y, area.w, area.h };
+			SDL_UpdateTexture(gobl::TextureManager::GetTexture(lightTexture), &local, &lightMap[local.y * lightWindow.w + local.x],
+				lightWindow.w * sizeof(Uint32));
+		}
+
+		lightDirty = {};
+	}
+
+	void Map::DrawLighting(SDL_Rect region)
 	{
+		// White ambient and no lights leaves every tile as it is
+		if (lights.empty() && ambient == Color::WHITE) return;
 
-		// FIXME: GetType is returning a tile not an object
-		mapLayers[id] = index;
+		// Cover the view plus a margin, snapped to chunks so panning only recomputes on crossing one
+		const int chunk = static_cast<int>(CHUNK_SIZE);
+		int x0 = std::max(0, region.x - LIGHT_MARGIN) / chunk * chunk;
+		int y0 = std::max(0, region.y - LIGHT_MARGIN) / chunk * chunk;
+		int x1 = std::min(static_cast<int>(width), (region.x + region.w + LIGHT_MARGIN + chunk - 1) / chunk * chunk);
+		int y1 = std::min(static_cast<int>(height), (region.y + region.h + LIGHT_MARGIN + chunk - 1) / chunk * chunk);
+		if (x1 <= x0 || y1 <= y0) return;
+
+		SDL_Rect window{ x0, y0, x1 - x0, y1 - y0 };
 
-		if (objLayers[id] >= 0) 
+		if (window.w != lightWindow.w || window.h != lightWindow.h)
 		{
-			auto t = GetType(objLayers[id] + GetTileTypeCount());
-			if (t.layer.length() > 0 && t.layer != GetType(mapLayers[id]).buildLayer)
-				SetObject(id, -1); // FIXME: Provide a refund for items that cost money
-			else std::cout << t.name << " is valid placement: " << t.buildLayer << " " << GetType(mapLayers[id]).layer << std::endl;
+			if (lightTexture != -1) gobl::TextureManager::DestroyTexture(lightTexture);
+			lightTexture = -1;
+			lightMap.assign(static_cast<size_t>(window.w) * window.h, 0);
+		}
+
+		if (SDL_RectEquals(&window, &lightWindow) == SDL_FALSE)
+		{
+			lightWindow = window;
+			lightDirty = window;
+		}
+
+		if (lightTexture == -1)
+		{
+			SDL_Texture* texture = SDL_CreateTexture(ge->GetRenderer().GetRenderer(), SDL_PIXELFORMAT_RGBA8888,
+				SDL_TEXTUREACCESS_STATIC, lightWindow.w, lightWindow.h);
+			if (texture == nullptr)
+			{
+				std::cout << "Unable to create the light map: " << SDL_GetError() << std::endl;
+				return;
+			}
+
+			// Blend between tile centers instead of hard tile edges
+			SDL_SetTextureScaleMode(texture, SDL_ScaleModeLinear);
+			lightTexture = gobl::TextureManager::CreateTexture(texture);
+			lightDirty = lightWindow;
 		}
 
-		colMap[id] = GetType(index).GetBoolAttribute("collision");
+		UpdateLighting();
+
+		IntVec2 scale = envTex->GetScale();
+
+		gobl::RenderObject ro{};
+		ro.textureId = lightTexture;
+		ro.sprRect = { 0, 0, lightWindow.w, lightWindow.h };
+		ro.rect = { lightWindow.x * scale.x, lightWindow.y * scale.y, lightWindow.w * scale.x, lightWindow.h * scale.y };
+		ro.layer = gobl::LAYER_LIGHTING;
+		ro.blend = SDL_BLENDMODE_MOD;
+		ro.padded = false;
+
+		gobl::RenderCommand command(ro);
+		command.flags |= gobl::RENDER_CAMERA;
+		ge->GetRenderer().QueueCommand(command);
 	}
-}
\ No newline at end of file
+}
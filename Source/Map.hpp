@@ -5,6 +5,8 @@
 #include "GoblEngine.hpp"
 #include <iostream>
 #include <unordered_map>
+#include <memory>
+#include <thread>
 
 namespace MAP 
 {
@@ -13,79 +15,274 @@ namespace MAP
 	const char MULTI_PLACE_ATT[6] = "multi";
 	const char LINEAR_ATT[7] = "linear";
 	const char WORKABLE_ATT[9] = "workable";
+	const char COLLISION_ATT[10] = "collision";
+	const char GROWABLE_ATT[9] = "growable";
+	const char LENGTH_ATT[7] = "length";
+	const char RATE_ATT[5] = "rate";
 
 	extern bool MAP_DEBUG_VERBOSE;
 
+	// Tiles along each side of a chunk, chunks are both the unit of storage and of pre-rendering
+	const Uint32 CHUNK_BITS = 4;
+	const Uint32 CHUNK_SIZE = 1 << CHUNK_BITS;
+	const Uint32 CHUNK_CELLS = CHUNK_SIZE * CHUNK_SIZE;
+
+	// Tiles along each side at most, keeps every cell id a positive int
+	const Uint32 MAX_MAP_SIZE = 32768;
+	static_assert(static_cast<Uint64>(MAX_MAP_SIZE / CHUNK_SIZE) * (MAX_MAP_SIZE / CHUNK_SIZE) * CHUNK_CELLS <= 0x7FFFFFFF,
+		"Cell ids past MAX_MAP_SIZE would overflow an int");
+
+	// Most of a large map is never touched, only this much around the origin is scattered with growables
+	const Uint32 GENERATED_AREA = 64;
+
+	struct MapChunk
+	{
+		int textureId = -1;
+		bool dirty = true;
+		Uint32 lastDrawn = 0;
+	};
+
+	// Cells of one chunk, only allocated once something in it stops being plain ground
+	struct CellChunk
+	{
+		Uint32 tiles[CHUNK_CELLS]{};
+		Sint32 objects[CHUNK_CELLS];
+		bool collision[CHUNK_CELLS]{};
+
+		Uint8 growthStage[CHUNK_CELLS]{}; // Frames grown so far
+		Uint32 growthDue[CHUNK_CELLS]{}; // Growth tick the next frame is reached on
+		Uint16 growthPeriod[CHUNK_CELLS]{}; // Growth ticks per frame, 0 once grown or not growable
+		Uint8 inUse[CHUNK_CELLS]{};
+		Sint32 owner[CHUNK_CELLS]; // Whoever is using the cell, -1 for nobody
+
+		CellChunk()
+		{
+			std::fill(std::begin(objects), std::end(objects), -1);
+			std::fill(std::begin(owner), std::end(owner), -1);
+		}
+	};
+
+	// Cells waiting on a future tick, bucketed by how far off it is so each tick only sees what is due.
+	// Far off timers sit in coarse slots and cascade down as their tick approaches.
+	class TimerWheel
+	{
+	private:
+		static const Uint32 SLOT_BITS = 6;
+		static const Uint32 SLOTS = 1 << SLOT_BITS;
+		static const Uint32 LEVELS = 4; // Covers 2^24 ticks, anything later waits in the last level
+
+		struct Timer
+		{
+			Uint32 id;
+			Uint32 due;
+		};
+
+		std::vector<Timer> slots[LEVELS][SLOTS]{};
+		std::vector<Timer> cascading{};
+		Uint32 now = 0;
+		size_t count = 0;
+
+		void Insert(const Timer& timer);
+
+	public:
+		// Drops every timer and restarts the clock at tick
+		void Reset(Uint32 tick);
+		// due must be after the current tick
+		void Schedule(Uint32 id, Uint32 due);
+		// Moves the clock on a tick and appends the ids due on it
+		void Advance(std::vector<Uint32>& due);
+
+		Uint32 GetNow() const { return now; }
+		size_t GetCount() const { return count; }
+	};
+
+	// A light placed in the world by an object with a <light> element
+	struct LightSource
+	{
+		Uint32 index = 0;
+		int x = 0, y = 0;
+		int radius = 0; // In tiles
+		Uint8 r = 0xFF, g = 0xFF, b = 0xFF;
+	};
+
+	// A thread that is joined rather than left running, both when it goes away and when another is moved over it
+	class SaveThread
+	{
+	private:
+		std::thread thread{};
+
+	public:
+		SaveThread() = default;
+		SaveThread(SaveThread&& other) = default;
+		SaveThread& operator=(SaveThread&& other)
+		{
+			Join();
+			thread = std::move(other.thread);
+			return *this;
+		}
+		~SaveThread() { Join(); }
+
+		template<typename Work>
+		void Start(Work work)
+		{
+			Join();
+			thread = std::thread(std::move(work));
+		}
+		void Join() { if (thread.joinable()) thread.join(); }
+	};
+
+	// Attribute and layer names are interned when mods load, everything after that compares integers
+	typedef Uint32 AttributeId;
+
+	// Interned in this order before anything else, 0 is the empty name
+	enum KnownAttribute : AttributeId
+	{
+		ATT_NONE = 0,
+		ATT_SPRITE,
+		ATT_PRICE,
+		ATT_MULTI,
+		ATT_LINEAR,
+		ATT_WORKABLE,
+		ATT_COLLISION,
+		ATT_GROWABLE,
+		ATT_LENGTH,
+		ATT_RATE,
+		ATT_KNOWN_COUNT,
+	};
+
+	class AttributeNames
+	{
+	public:
+		static AttributeId Intern(const std::string& name);
+		// ATT_NONE when the name was never interned
+		static AttributeId Find(const std::string& name);
+		static const std::string& GetName(AttributeId id);
+	};
+
+	enum TileFlags : Uint32
+	{
+		TILE_MULTI = 1,
+		TILE_LINEAR = 2,
+		TILE_WORKABLE = 4,
+		TILE_COLLISION = 8,
+		TILE_GROWABLE = 16,
+	};
+
+	// The attributes hot loops read, kept in step with the named ones by TileData's setters
+	struct TileInfo
+	{
+		int sprite = 0;
+		int price = 0;
+		Uint32 flags = 0;
+		AttributeId layer = ATT_NONE; // What layer this is on
+		AttributeId buildLayer = ATT_NONE; // What can be placed on this
+		int growLength = 0; // Frames of a growable, the last one is fully grown
+		int growRate = 0; // Updates spent on each frame, plus one
+
+		bool Has(Uint32 flag) const { return (flags & flag) != 0; }
+	};
+
 	struct TileData 
 	{
 	private:
-		std::unordered_map<std::string, int> intAtts{};
-		std::unordered_map<std::string, bool> boolAtts{};
-		std::unordered_map<std::string, std::string> strAtts{};
+		std::unordered_map<AttributeId, int> intAtts{};
+		std::unordered_map<AttributeId, bool> boolAtts{};
+		std::unordered_map<AttributeId, std::string> strAtts{};
+
+		static Uint32 GetFlag(AttributeId id)
+		{
+			switch (id)
+			{
+			case ATT_MULTI: return TILE_MULTI;
+			case ATT_LINEAR: return TILE_LINEAR;
+			case ATT_WORKABLE: return TILE_WORKABLE;
+			case ATT_COLLISION: return TILE_COLLISION;
+			case ATT_GROWABLE: return TILE_GROWABLE;
+			default: return 0;
+			}
+		}
 
 	public:
 		std::string name = "";
 
-		// What can be placed on this
+		// Names kept for display, info holds the interned ids
 		std::string buildLayer = "";
-
-		// What layer this is on
 		std::string layer = "";
 
-		void ClearIntAttribute(std::string val) { intAtts.erase(val); }
-		void ClearBoolAttribute(std::string val) { boolAtts.erase(val); }
-		void ClearStrAttribute(std::string val) { strAtts.erase(val); }
+		TileInfo info{};
+
+		void SetLayer(const std::string& value) { layer = value; info.layer = AttributeNames::Intern(value); }
+		void SetBuildLayer(const std::string& value) { buildLayer = value; info.buildLayer = AttributeNames::Intern(value); }
 
-		int GetIntAttribute(std::string val)
+		void ClearIntAttribute(AttributeId id) { intAtts.erase(id); }
+		void ClearBoolAttribute(AttributeId id) { boolAtts.erase(id); info.flags &= ~GetFlag(id); }
+		void ClearStrAttribute(AttributeId id) { strAtts.erase(id); }
+		void ClearIntAttribute(const std::string& val) { ClearIntAttribute(AttributeNames::Find(val)); }
+		void ClearBoolAttribute(const std::string& val) { ClearBoolAttribute(AttributeNames::Find(val)); }
+		void ClearStrAttribute(const std::string& val) { ClearStrAttribute(AttributeNames::Find(val)); }
+
+		int GetIntAttribute(AttributeId id) const
 		{
-			if (intAtts.find(val) == intAtts.end())
+			auto att = intAtts.find(id);
+			if (att == intAtts.end())
 			{
-				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: int attribute; " << val << " not found." << std::endl;
+				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: int attribute; " << AttributeNames::GetName(id) << " not found." << std::endl;
 				return 0;
 			}
-			else return intAtts[val];
+			else return att->second;
 		}
-		bool GetBoolAttribute(std::string val)
+		bool GetBoolAttribute(AttributeId id) const
 		{
-			if (boolAtts.find(val) == boolAtts.end())
+			auto att = boolAtts.find(id);
+			if (att == boolAtts.end())
 			{
-				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: bool attribute; " << val << " not found." << std::endl;
+				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: bool attribute; " << AttributeNames::GetName(id) << " not found." << std::endl;
 				return false;
 			}
-			else return boolAtts[val];
+			else return att->second;
 		}
-		std::string GetStrAttribute(std::string val)
+		const std::string& GetStrAttribute(AttributeId id) const
 		{
-			if (strAtts.find(val) == strAtts.end())
+			static const std::string empty = "";
+
+			auto att = strAtts.find(id);
+			if (att == strAtts.end())
 			{
-				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: string attribute; " << val << " not found." << std::endl;
-				return "";
+				if (MAP_DEBUG_VERBOSE) std::cout << "ERROR: string attribute; " << AttributeNames::GetName(id) << " not found." << std::endl;
+				return empty;
 			}
-			else return strAtts[val];
+			else return att->second;
 		}
+		int GetIntAttribute(const std::string& val) const { return GetIntAttribute(AttributeNames::Find(val)); }
+		bool GetBoolAttribute(const std::string& val) const { return GetBoolAttribute(AttributeNames::Find(val)); }
+		const std::string& GetStrAttribute(const std::string& val) const { return GetStrAttribute(AttributeNames::Find(val)); }
 
-		void SetIntAttribute(std::string name, int val) 
+		void SetIntAttribute(AttributeId id, int val) 
 		{ 
-			if (intAtts.find(name) == intAtts.end()) intAtts.emplace(name, val);
-			else intAtts[name] = val;
-		}
-		void SetBoolAttribute(std::string name, bool val) 
-		{
-			if (boolAtts.find(name) == boolAtts.end()) boolAtts.emplace(name, val);
-			else boolAtts[name] = val;
+			intAtts[id] = val;
+
+			if (id == ATT_SPRITE) info.sprite = val;
+			else if (id == ATT_PRICE) info.price = val;
+			else if (id == ATT_LENGTH) info.growLength = val;
+			else if (id == ATT_RATE) info.growRate = val;
 		}
-		void SetStrAttribute(std::string name, std::string val)
+		void SetBoolAttribute(AttributeId id, bool val) 
 		{
-			if (strAtts.find(name) == strAtts.end()) strAtts.emplace(name, val);
-			else strAtts[name] = val;
+			boolAtts[id] = val;
+
+			if (val) info.flags |= GetFlag(id);
+			else info.flags &= ~GetFlag(id);
 		}
+		void SetStrAttribute(AttributeId id, const std::string& val) { strAtts[id] = val; }
+		void SetIntAttribute(const std::string& name, int val) { SetIntAttribute(AttributeNames::Intern(name), val); }
+		void SetBoolAttribute(const std::string& name, bool val) { SetBoolAttribute(AttributeNames::Intern(name), val); }
+		void SetStrAttribute(const std::string& name, const std::string& val) { SetStrAttribute(AttributeNames::Intern(name), val); }
 	};
 
 	class Map
 	{
 	private:
 		Uint16 width = 0, height = 0;
-		Uint32 mapLength = 0;
 
 		std::vector<TileData> tiles{};
 		gobl::Sprite* envTex = nullptr;
@@ -93,64 +290,234 @@ namespace MAP
 		std::vector<TileData> objects{};
 		std::vector<gobl::Sprite*> objSprites{};
 
-		Uint32* mapLayers = nullptr;
-		Sint32* objLayers = nullptr;
-		bool* colMap = nullptr;
 		Uint64 sprLength = 0;
 
-		std::vector<Uint32> workables{};
+		// Cell ids hold the chunk in the high bits and the cell within it in the low CHUNK_BITS * 2
+		std::vector<std::unique_ptr<CellChunk>> cells{}; // chunksX * chunksY, empty until touched
+		std::vector<Uint32> liveChunks{}; // Chunks that have cells
+
+		// Workable cells by the object on them, a free list per object type keeps claiming constant time
+		struct WorkableSlot
+		{
+			Sint32 type = -1;
+			Sint32 freeIndex = -1; // Position in its type's free list, -1 while claimed
+		};
+		std::unordered_map<Uint32, WorkableSlot> workables{};
+		std::vector<std::vector<Uint32>> freeWorkables{}; // Indexed by object type
+
+		// Growing cells keyed by the tick of their next frame, entries left by a reset cell are skipped when due
+		TimerWheel growthWheel{};
+		std::vector<Uint32> dueCells{};
+
+		// Pre-rendered tiles and objects, redrawn only when something in them changes
+		std::vector<MapChunk> chunks{};
+		Uint32 chunksX = 0, chunksY = 0;
+		bool chunksDebug = false;
+		MapChunk plainChunk{}; // Shared by every chunk that was never touched
+		Uint32 drawFrame = 0;
+		std::vector<Uint32> bakedChunks{}; // Chunks holding a texture of their own
+
+		// Light per tile around the view, drawn as one stretched texture multiplied over the world
+		std::vector<LightSource> lights{};
+		std::vector<Uint32> lightMap{};
+		SDL_Rect lightWindow{}; // Tiles lightMap and the texture cover
+		Color ambient{ 0xFF, 0xFF, 0xFF };
+		int lightTexture = -1;
+		int maxLightRadius = 0;
+		SDL_Rect lightDirty{}; // Tiles to recompute and upload, empty when clean
+
+		// Anything that changes how the map looks bumps this, cached renders compare against it
+		Uint32 revision = 0;
+
+		// Blurred world behind menus, redrawn only when the map or camera moves
+		int blurTarget = -1;
+		int blurTexture = -1;
+		Uint32 blurRevision = 0;
+		gobl::CameraTransform blurView{};
+		SDL_Rect blurRegion{};
 
 		gobl::GoblEngine* ge = nullptr;
 
+		// Writes the last snapshot taken by Save
+		SaveThread saveThread{};
+
+	private: // Cells
+		static Uint32 ChunkOf(Uint32 id) { return id >> (CHUNK_BITS * 2); }
+		static Uint32 CellOf(Uint32 id) { return id & (CHUNK_CELLS - 1); }
+		Uint32 MakeId(Uint32 x, Uint32 y) const
+		{
+			return (((y >> CHUNK_BITS) * chunksX + (x >> CHUNK_BITS)) << (CHUNK_BITS * 2)) | ((y & (CHUNK_SIZE - 1)) << CHUNK_BITS) |
+				(x & (CHUNK_SIZE - 1));
+		}
+		// In tiles
+		IntVec2 GetCellPos(Uint32 id) const
+		{
+			Uint32 chunk = ChunkOf(id);
+			return { static_cast<int>((chunk % chunksX) * CHUNK_SIZE + (id & (CHUNK_SIZE - 1))),
+				static_cast<int>((chunk / chunksX) * CHUNK_SIZE + ((id >> CHUNK_BITS) & (CHUNK_SIZE - 1))) };
+		}
+		bool IsValidId(Uint32 id) const
+		{
+			if (ChunkOf(id) >= cells.size()) return false;
+
+			IntVec2 pos = GetCellPos(id);
+			return pos.x < width && pos.y < height;
+		}
+		// nullptr while the chunk is still plain ground
+		CellChunk* FindChunk(Uint32 id) const { return ChunkOf(id) < cells.size() ? cells[ChunkOf(id)].get() : nullptr; }
+		CellChunk& TouchChunk(Uint32 id);
+		// Untouched chunks that lie fully inside the map all look the same
+		bool IsPlainChunk(Uint32 cx, Uint32 cy) const
+		{
+			return cells[cy * chunksX + cx] == nullptr && (cx + 1) * CHUNK_SIZE <= width && (cy + 1) * CHUNK_SIZE <= height;
+		}
+
+	private: // Chunks
+		void InvalidateTile(Uint32 index);
+		void BakeChunk(Uint32 cx, Uint32 cy);
+		void BakePlainChunk();
+		void EvictChunks();
+		void ResetCell(Uint32 index);
+		void ScheduleGrowth(Uint32 index);
+		void AdvanceGrowth(Uint32 index);
+		void BakeRegion(Uint32 w, Uint32 h, int offX, int offY);
+		void QueueRegion(Uint32 w, Uint32 h, int offX, int offY);
+
+	private: // Workables
+		void RegisterWorkable(Uint32 id, Sint32 type);
+		void UnregisterWorkable(Uint32 id);
+		void TakeFreeWorkable(WorkableSlot& slot);
+		void PutFreeWorkable(Uint32 id, WorkableSlot& slot);
+
+	private: // Lighting
+		void InvalidateLight(Uint32 index, int radius);
+		void UpdateLightSource(Uint32 index);
+		bool HasLineOfSight(int x0, int y0, int x1, int y1);
+		void UpdateLighting();
+		void DrawLighting(SDL_Rect region);
+
 	private: // XML stuff
 		void LoadModData(const char* path);
 
 	public: // Main map stuff
+		// Parses every mod file in path on the loader's workers, the constructor then skips the disk
+		static void PreloadMods(gobl::AssetLoader& loader, const char* path);
+
 		Map() = default;
+		// A write still in flight finishes before the map it came from is replaced or freed
+		Map(Map&& other) = default;
+		Map& operator=(Map&& other) = default;
+		~Map() { WaitForSave(); }
 		void Destroy() 
 		{
+			WaitForSave();
+
 			if (envTex != nullptr) delete envTex; 
 
-			delete mapLayers;
-			delete objLayers;
-			delete colMap;
+			cells.clear();
+			liveChunks.clear();
 
 			for (auto& s : objSprites) delete s;
+
+			for (auto& c : chunks)
+				if (c.textureId != -1) gobl::TextureManager::DestroyTexture(c.textureId);
+			chunks.clear();
+			if (plainChunk.textureId != -1) gobl::TextureManager::DestroyTexture(plainChunk.textureId);
+			plainChunk = {};
+			bakedChunks.clear();
+
+			if (lightTexture != -1) gobl::TextureManager::DestroyTexture(lightTexture);
+			lightTexture = -1;
+
+			if (blurTarget != -1) gobl::TextureManager::DestroyTexture(blurTarget);
+			if (blurTexture != -1) gobl::TextureManager::DestroyTexture(blurTexture);
+			blurTarget = blurTexture = -1;
+			lights.clear();
 		}
 
 		Map(gobl::GoblEngine* ge, int w, int h, const char* path);
-		void ResetTexture();
-		void DrawTile(Uint32 x, Uint32 y);
+
+		// Snapshots the cells and writes them on a background thread, returns once the snapshot is taken
+		void Save(const std::string& path);
+		// Replaces the world with a save, the map keeps its current contents if the file is bad
+		bool Load(const std::string& path);
+		void WaitForSave() { saveThread.Join(); }
+		void DrawTile(Uint32 x, Uint32 y) { DrawTile(x, y, { 0, 0 }, true); }
+		void DrawTile(Uint32 x, Uint32 y, IntVec2 origin, bool relative);
 		void Draw();
 		void DrawRegion(Uint32 w, Uint32 h, int x, int y);
 		void BlurDrawRegion(Uint32 w, Uint32 h, int offX, int offY);
 
 		void UpdateObjects();
+		// Times UpdateObjects over a size x size map where every cell is growing at rate
+		static void BenchmarkObjects(Uint16 size = 1024, int iterations = 100, int rate = 3);
+		void InvalidateChunks() { for (auto& c : chunks) c.dirty = true; plainChunk.dirty = true; revision++; }
+
+		void SetCollision(Uint32 index, bool value);
+		// Outside the map counts as blocked
+		bool GetCollision(Uint32 index)
+		{
+			if (IsValidId(index) == false) return true;
 
-		void SetCollision(Uint32 index, bool value) { colMap[index] = value; }
-		bool GetCollision(Uint32 index) { return colMap[index]; }
+			CellChunk* chunk = FindChunk(index);
+			return chunk != nullptr && chunk->collision[CellOf(index)];
+		}
+		// Cells with something in them, memory follows this rather than the map size
+		size_t GetLiveChunkCount() { return liveChunks.size(); }
 
 		const IntVec2 GetMapSize() { return { width, height }; }
 
 		Uint32 GetTileTypeCount() { return tiles.size(); }
 		Uint32 GetObjectCount() { return objSprites.size(); }
 
-		MAP::TileData GetType(const Uint32 layerID) 
+		const MAP::TileData& GetType(const Uint32 layerID) const
 		{
+			static const TileData none{};
+
 			if (layerID < tiles.size()) return tiles[layerID];
 			else if (layerID - tiles.size() < objects.size()) return objects[layerID - tiles.size()];
 
-			return TileData{};
+			return none;
 		}
+		const TileInfo& GetInfo(const Uint32 layerID) const { return GetType(layerID).info; }
 
 		void SetObject(Uint32 id, Sint32 index);
 		void SetTile(int id, Uint32 index);
+		// A free workable without claiming it, -1 when every one is taken
 		int GetEmptyWorkable();
 		IntVec2 GetWorkable(int id);
+		// Claims a free workable for owner, of the given object type or any when -1. Returns the cell or -1.
+		int ClaimWorkable(Sint32 owner, Sint32 type = -1);
+		// Only the owner can give a workable back
+		bool ReleaseWorkable(Uint32 id, Sint32 owner);
+		size_t GetWorkableCount() { return workables.size(); }
 
-		Uint32 GetTileLayer(int id) { return mapLayers[id]; }
-		int GetObjectLayer(int id) { return objLayers[id]; }
+		Uint32 GetTileLayer(int id)
+		{
+			CellChunk* chunk = FindChunk(id);
+			return chunk != nullptr ? chunk->tiles[CellOf(id)] : 0;
+		}
+		int GetObjectLayer(int id)
+		{
+			CellChunk* chunk = FindChunk(id);
+			return chunk != nullptr ? chunk->objects[CellOf(id)] : -1;
+		}
+		bool IsInUse(Uint32 id)
+		{
+			CellChunk* chunk = FindChunk(id);
+			return chunk != nullptr && chunk->inUse[CellOf(id)] != 0;
+		}
+		Sint32 GetOwner(Uint32 id)
+		{
+			CellChunk* chunk = FindChunk(id);
+			return chunk != nullptr ? chunk->owner[CellOf(id)] : -1;
+		}
+		void SetInUse(Uint32 id, bool value, Sint32 user = -1);
 		gobl::Sprite* GetTileTexture() { return envTex; }
+		gobl::SpriteHandle GetTileSheet() { return envTex->GetSpriteHandle(); }
+		gobl::SpriteHandle GetObjectSheet(const Uint32 index) { return objSprites[index]->GetSpriteHandle(); }
+		size_t GetLightCount() { return lights.size(); }
+		IntVec2 GetTileSize() { return envTex->GetScale(); }
 		gobl::Sprite* GetTexture(const Uint32 index) { return objSprites[index]; }
 
 		bool Overlaps(int id, int x, int y);
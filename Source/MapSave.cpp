@@ -0,0 +1,463 @@
+#include "Map.hpp"
+#include "ByteStream.hpp"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Saving and loading of the map's cells.
+//
+// File layout, native byte order:
+//   header    "GMAP" Uint32 version, Uint16 width, Uint16 height, Uint32 tile types, Uint32 object types,
+//             Uint32 chunk count, Uint32 workable count, Uint32 growth tick (version 2)
+//   table     chunk count x { Uint32 chunk, Uint32 offset }
+//   workables Uint32[workable count]
+//   chunks    one section per cell array in CellChunk order
+// A section is SECTION_RAW followed by CHUNK_CELLS values, or SECTION_RLE, a Uint16 run count and that many
+// { Uint16 length, value } runs. Untouched chunks are not stored at all.
+// Version 1 stored a Uint8 growth counter and period where version 2 stores the Uint32 due tick and Uint16 period.
+namespace MAP
+{
+	namespace
+	{
+		const char SAVE_MAGIC[4] = { 'G', 'M', 'A', 'P' };
+		const Uint32 SAVE_VERSION = 2;
+		const Uint8 SECTION_RAW = 0;
+		const Uint8 SECTION_RLE = 1;
+
+		static_assert(std::is_trivially_copyable<CellChunk>::value, "Saves snapshot chunks with a plain copy");
+
+		// Everything the writer needs, copied so the game can keep changing the map
+		struct SaveSnapshot
+		{
+			std::string path{};
+			Uint16 width = 0, height = 0;
+			Uint32 tileTypes = 0, objectTypes = 0;
+			Uint32 growthTick = 0;
+			std::vector<Uint32> chunkIds{};
+			std::vector<CellChunk> chunks{};
+			std::vector<Uint32> workables{};
+		};
+
+		using gobl::Append;
+		using gobl::Patch;
+		using gobl::ByteReader;
+
+		// Long runs of the same value, like empty ground or nothing growing, shrink to a few bytes
+		template<typename T>
+		void EncodeSection(std::vector<Uint8>& out, const T* values)
+		{
+			Uint32 runs = 1;
+			for (Uint32 i = 1; i < CHUNK_CELLS; i++) runs += values[i] != values[i - 1];
+
+			if (runs * (sizeof(Uint16) + sizeof(T)) >= CHUNK_CELLS * sizeof(T))
+			{
+				Append(out, SECTION_RAW);
+				const Uint8* bytes = reinterpret_cast<const Uint8*>(values);
+				out.insert(out.end(), bytes, bytes + CHUNK_CELLS * sizeof(T));
+				return;
+			}
+
+			Append(out, SECTION_RLE);
+			Append(out, static_cast<Uint16>(runs));
+
+			Uint32 start = 0;
+			for (Uint32 i = 1; i <= CHUNK_CELLS; i++)
+			{
+				if (i < CHUNK_CELLS && values[i] == values[start]) continue;
+
+				Append(out, static_cast<Uint16>(i - start));
+				Append(out, values[start]);
+				start = i;
+			}
+		}
+
+		std::vector<Uint8> EncodeSave(const SaveSnapshot& save)
+		{
+			std::vector<Uint8> out{};
+			out.reserve(64 + save.chunks.size() * sizeof(CellChunk) / 4);
+
+			out.insert(out.end(), SAVE_MAGIC, SAVE_MAGIC + sizeof(SAVE_MAGIC));
+			Append(out, SAVE_VERSION);
+			Append(out, save.width);
+			Append(out, save.height);
+			Append(out, save.tileTypes);
+			Append(out, save.objectTypes);
+			Append(out, static_cast<Uint32>(save.chunks.size()));
+			Append(out, static_cast<Uint32>(save.workables.size()));
+			Append(out, save.growthTick);
+
+			// Offsets are filled in once each chunk is written
+			size_t table = out.size();
+			for (Uint32 id : save.chunkIds)
+			{
+				Append(out, id);
+				Append(out, Uint32{ 0 });
+			}
+
+			for (Uint32 id : save.workables) Append(out, id);
+
+			for (size_t i = 0; i < save.chunks.size(); i++)
+			{
+				const CellChunk& chunk = save.chunks[i];
+				Patch(out, table + i * sizeof(Uint32) * 2 + sizeof(Uint32), static_cast<Uint32>(out.size()));
+
+				Uint8 collision[CHUNK_CELLS];
+				for (Uint32 c = 0; c < CHUNK_CELLS; c++) collision[c] = chunk.collision[c];
+
+				EncodeSection(out, chunk.tiles);
+				EncodeSection(out, chunk.objects);
+				EncodeSection(out, collision);
+				EncodeSection(out, chunk.growthStage);
+				EncodeSection(out, chunk.growthDue);
+				EncodeSection(out, chunk.growthPeriod);
+				EncodeSection(out, chunk.inUse);
+				EncodeSection(out, chunk.owner);
+			}
+
+			return out;
+		}
+
+		void WriteSave(const SaveSnapshot& save)
+		{
+			std::vector<Uint8> data = EncodeSave(save);
+
+			std::error_code error{};
+			std::filesystem::path path(save.path);
+			if (path.has_parent_path()) std::filesystem::create_directories(path.parent_path(), error);
+
+			// Write beside the old save and swap, a crash mid-write never loses the last good one
+			std::string temp = save.path + ".tmp";
+			{
+				std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+				file.write(reinterpret_cast<const char*>(data.data()), data.size());
+
+				if (file.good() == false)
+				{
+					std::cout << "ERROR: Unable to write the save " << temp << std::endl;
+					return;
+				}
+			}
+
+			std::filesystem::rename(temp, save.path, error);
+			if (error) std::cout << "ERROR: Unable to replace the save " << save.path << ": " << error.message() << std::endl;
+		}
+
+		// Read only view of a whole file, mapped instead of read so loading has no copy of its own
+		class MappedFile
+		{
+		private:
+			const Uint8* data = nullptr;
+			size_t size = 0;
+#ifdef _WIN32
+			HANDLE file = INVALID_HANDLE_VALUE;
+			HANDLE mapping = NULL;
+#endif
+
+		public:
+			explicit MappedFile(const std::string& path)
+			{
+#ifdef _WIN32
+				file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+				if (file == INVALID_HANDLE_VALUE) return;
+
+				LARGE_INTEGER length{};
+				if (GetFileSizeEx(file, &length) == FALSE || length.QuadPart == 0) return;
+
+				mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+				if (mapping == NULL) return;
+
+				data = static_cast<const Uint8*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+				if (data != nullptr) size = static_cast<size_t>(length.QuadPart);
+#else
+				int fd = open(path.c_str(), O_RDONLY);
+				if (fd == -1) return;
+
+				struct stat info{};
+				if (fstat(fd, &info) == 0 && info.st_size > 0)
+				{
+					void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+					if (view != MAP_FAILED)
+					{
+						data = static_cast<const Uint8*>(view);
+						size = static_cast<size_t>(info.st_size);
+					}
+				}
+
+				// The mapping outlives the descriptor
+				close(fd);
+#endif
+			}
+
+			~MappedFile()
+			{
+#ifdef _WIN32
+				if (data != nullptr) UnmapViewOfFile(data);
+				if (mapping != NULL) CloseHandle(mapping);
+				if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+				if (data != nullptr) munmap(const_cast<Uint8*>(data), size);
+#endif
+			}
+
+			MappedFile(const MappedFile&) = delete;
+			MappedFile& operator=(const MappedFile&) = delete;
+
+			bool IsOpen() { return data != nullptr; }
+			const Uint8* GetData() { return data; }
+			size_t GetSize() { return size; }
+		};
+
+		// Fills one cell array from a section, leaving the reader bad if it doesn't hold exactly CHUNK_CELLS values
+		template<typename T>
+		void ReadSection(ByteReader& reader, T* values)
+		{
+			Uint8 encoding = reader.Read<Uint8>();
+
+			// Raw sections are copied straight out of the mapping
+			if (encoding == SECTION_RAW)
+			{
+				reader.ReadBytes(values, CHUNK_CELLS * sizeof(T));
+				return;
+			}
+
+			if (encoding != SECTION_RLE)
+			{
+				reader.bad = true;
+				return;
+			}
+
+			Uint16 runs = reader.Read<Uint16>();
+			Uint32 filled = 0;
+
+			for (Uint16 r = 0; r < runs && reader.bad == false; r++)
+			{
+				Uint16 length = reader.Read<Uint16>();
+				T value = reader.Read<T>();
+
+				if (length > CHUNK_CELLS - filled)
+				{
+					reader.bad = true;
+					return;
+				}
+
+				std::fill(values + filled, values + filled + length, value);
+				filled += length;
+			}
+
+			if (filled != CHUNK_CELLS) reader.bad = true;
+		}
+	}
+
+	void Map::Save(const std::string& path)
+	{
+		gobl::ProfileScope profile(gobl::PROFILE_MAP);
+		if (cells.empty()) return;
+
+		// Only one save in flight, the last one has normally long finished by now
+		WaitForSave();
+
+		SaveSnapshot save{};
+		save.path = path;
+		save.width = width;
+		save.height = height;
+		save.tileTypes = static_cast<Uint32>(tiles.size());
+		save.objectTypes = static_cast<Uint32>(objects.size());
+		save.workables.reserve(workables.size());
+		for (auto& workable : workables) save.workables.push_back(workable.first);
+		save.growthTick = growthWheel.GetNow();
+
+		save.chunkIds = liveChunks;
+		save.chunks.reserve(liveChunks.size());
+		for (Uint32 index : liveChunks) save.chunks.push_back(*cells[index]);
+
+		// Encoding and disk access both happen off the game thread
+		saveThread.Start([save = std::move(save)]() { WriteSave(save); });
+	}
+
+	bool Map::Load(const std::string& path)
+	{
+		MappedFile file(path);
+		if (file.IsOpen() == false)
+		{
+			std::cout << "ERROR: Unable to open save " << path << std::endl;
+			return false;
+		}
+
+		ByteReader reader{ file.GetData(), file.GetSize() };
+
+		char magic[4]{};
+		reader.ReadBytes(magic, sizeof(magic));
+		Uint32 version = reader.Read<Uint32>();
+		Uint16 saveWidth = reader.Read<Uint16>();
+		Uint16 saveHeight = reader.Read<Uint16>();
+		Uint32 tileTypes = reader.Read<Uint32>();
+		Uint32 objectTypes = reader.Read<Uint32>();
+		Uint32 chunkCount = reader.Read<Uint32>();
+		Uint32 workableCount = reader.Read<Uint32>();
+		Uint32 growthTick = version >= 2 ? reader.Read<Uint32>() : 0;
+
+		if (reader.bad || std::memcmp(magic, SAVE_MAGIC, sizeof(magic)) != 0 || version == 0 || version > SAVE_VERSION || saveWidth == 0 ||
+			saveHeight == 0)
+		{
+			std::cout << "ERROR: " << path << " is not a version " << SAVE_VERSION << " or older save" << std::endl;
+			return false;
+		}
+
+		if (saveWidth > MAX_MAP_SIZE || saveHeight > MAX_MAP_SIZE)
+		{
+			std::cout << "ERROR: " << path << " is " << saveWidth << "x" << saveHeight << ", maps are at most " << MAX_MAP_SIZE << " tiles a side"
+				<< std::endl;
+			return false;
+		}
+
+		if (tileTypes != tiles.size() || objectTypes != objects.size())
+			std::cout << path << " was saved with different mods, unknown tiles and objects are removed" << std::endl;
+
+		Uint32 saveChunksX = (saveWidth + CHUNK_SIZE - 1) / CHUNK_SIZE;
+		Uint32 saveChunksY = (saveHeight + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+		// Counts are checked against the map and what is left of the file before anything is sized from them
+		size_t remaining = reader.size - reader.pos;
+		if (chunkCount > saveChunksX * saveChunksY || chunkCount * sizeof(Uint32) * 2 > remaining ||
+			workableCount * sizeof(Uint32) > remaining - chunkCount * sizeof(Uint32) * 2)
+		{
+			std::cout << "ERROR: " << path << " is truncated or corrupt" << std::endl;
+			return false;
+		}
+
+		std::vector<Uint32> chunkIds(chunkCount), offsets(chunkCount);
+		for (Uint32 i = 0; i < chunkCount && reader.bad == false; i++)
+		{
+			chunkIds[i] = reader.Read<Uint32>();
+			offsets[i] = reader.Read<Uint32>();
+		}
+
+		std::vector<Uint32> savedWorkables(workableCount);
+		if (workableCount > 0) reader.ReadBytes(savedWorkables.data(), workableCount * sizeof(Uint32));
+
+		// Decode everything before touching the map so a bad file leaves it as it was
+		std::vector<std::unique_ptr<CellChunk>> loaded(saveChunksX * saveChunksY);
+		for (Uint32 i = 0; i < chunkCount && reader.bad == false; i++)
+		{
+			if (chunkIds[i] >= loaded.size() || loaded[chunkIds[i]] != nullptr)
+			{
+				reader.bad = true;
+				break;
+			}
+
+			auto chunk = std::make_unique<CellChunk>();
+			Uint8 collision[CHUNK_CELLS];
+
+			reader.pos = offsets[i];
+			ReadSection(reader, chunk->tiles);
+			ReadSection(reader, chunk->objects);
+			ReadSection(reader, collision);
+			ReadSection(reader, chunk->growthStage);
+
+			if (version >= 2)
+			{
+				ReadSection(reader, chunk->growthDue);
+				ReadSection(reader, chunk->growthPeriod);
+			}
+			else
+			{
+				// Counters become the tick the frame finishes on
+				Uint8 counter[CHUNK_CELLS], period[CHUNK_CELLS];
+				ReadSection(reader, counter);
+				ReadSection(reader, period);
+
+				for (Uint32 c = 0; c < CHUNK_CELLS; c++)
+				{
+					chunk->growthPeriod[c] = period[c];
+					chunk->growthDue[c] = growthTick + std::max(period[c] - counter[c], 1);
+				}
+			}
+
+			ReadSection(reader, chunk->inUse);
+			ReadSection(reader, chunk->owner);
+
+			for (Uint32 c = 0; c < CHUNK_CELLS; c++)
+			{
+				chunk->collision[c] = collision[c] != 0;
+
+				if (chunk->tiles[c] >= tiles.size()) chunk->tiles[c] = 0;
+				if (chunk->objects[c] >= static_cast<Sint32>(objects.size()) || chunk->objects[c] < -1) chunk->objects[c] = -1;
+				if (chunk->objects[c] == -1) chunk->growthPeriod[c] = 0;
+
+				// A due tick that has passed or lies beyond a whole period restarts the frame
+				Uint32 wait = chunk->growthDue[c] - growthTick;
+				if (wait == 0 || wait > chunk->growthPeriod[c]) chunk->growthDue[c] = growthTick + chunk->growthPeriod[c];
+			}
+
+			loaded[chunkIds[i]] = std::move(chunk);
+		}
+
+		if (reader.bad)
+		{
+			std::cout << "ERROR: " << path << " is truncated or corrupt" << std::endl;
+			return false;
+		}
+
+		WaitForSave();
+
+		// Swap the world over, every baked chunk and light is rebuilt from the new cells
+		for (auto& c : chunks)
+			if (c.textureId != -1) gobl::TextureManager::DestroyTexture(c.textureId);
+		bakedChunks.clear();
+
+		width = saveWidth;
+		height = saveHeight;
+		chunksX = saveChunksX;
+		chunksY = saveChunksY;
+		chunks.assign(chunksX * chunksY, MapChunk{});
+		cells = std::move(loaded);
+		liveChunks.assign(chunkIds.begin(), chunkIds.end());
+		InvalidateChunks();
+
+		// Goblins aren't saved, so every workable starts out free
+		workables.clear();
+		freeWorkables.clear();
+		for (Uint32 id : savedWorkables)
+		{
+			int type = GetObjectLayer(id);
+			if (type < 0 || objects[type].info.Has(TILE_WORKABLE) == false || workables.count(id) != 0) continue;
+
+			SetInUse(id, false);
+			RegisterWorkable(id, type);
+		}
+
+		lights.clear();
+		maxLightRadius = 0;
+		lightWindow = {};
+		lightDirty = {};
+		growthWheel.Reset(growthTick);
+
+		for (Uint32 index : liveChunks)
+		{
+			const CellChunk& chunk = *cells[index];
+
+			for (Uint32 c = 0; c < CHUNK_CELLS; c++)
+			{
+				Uint32 id = (index << (CHUNK_BITS * 2)) | c;
+				if (chunk.objects[c] >= 0) UpdateLightSource(id);
+				if (chunk.growthPeriod[c] != 0) growthWheel.Schedule(id, chunk.growthDue[c]);
+			}
+		}
+
+		std::cout << "Loaded " << path << ", " << saveWidth << "x" << saveHeight << " with " << chunkCount << " chunks" << std::endl;
+
+		return true;
+	}
+}
@@ -0,0 +1,162 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gobl
+{
+    namespace
+    {
+        struct OpenScope
+        {
+            ProfileStage stage = PROFILE_EVENTS;
+            Uint64 start = 0;
+            Uint64 children = 0; // Time taken by scopes nested inside this one
+        };
+
+        ProfileFrame history[Profiler::HISTORY]{};
+        size_t head = 0; // Next slot to write
+        size_t count = 0;
+
+        ProfileFrame current{};
+        Uint64 frameStart = 0;
+
+        OpenScope scopes[Profiler::MAX_DEPTH]{};
+        size_t depth = 0;
+
+        float ToMs(Uint64 ticks) { return static_cast<float>(ticks * 1000.0 / SDL_GetPerformanceFrequency()); }
+    }
+
+    void Profiler::Begin(ProfileStage stage)
+    {
+        // Past the limit the time is left with the enclosing scope
+        if (depth < MAX_DEPTH) scopes[depth] = { stage, SDL_GetPerformanceCounter(), 0 };
+        depth++;
+    }
+
+    void Profiler::End()
+    {
+        if (depth == 0) return;
+        depth--;
+        if (depth >= MAX_DEPTH) return;
+
+        OpenScope& scope = scopes[depth];
+        Uint64 elapsed = SDL_GetPerformanceCounter() - scope.start;
+
+        current.stages[scope.stage] += ToMs(elapsed - std::min(elapsed, scope.children));
+        if (depth > 0 && depth - 1 < MAX_DEPTH) scopes[depth - 1].children += elapsed;
+    }
+
+    void Profiler::EndFrame(Uint32 drawCalls, Uint32 textPages)
+    {
+        Uint64 now = SDL_GetPerformanceCounter();
+
+        current.total = frameStart == 0 ? 0 : ToMs(now - frameStart);
+
+        float staged = 0;
+        for (Uint8 s = 0; s < PROFILE_OTHER; s++) staged += current.stages[s];
+        current.stages[PROFILE_OTHER] = std::max(0.0f, current.total - staged);
+        current.drawCalls = drawCalls;
+        current.textPages = textPages;
+
+        history[head] = current;
+        head = (head + 1) % HISTORY;
+        count = std::min(count + 1, HISTORY);
+
+        current = {};
+        frameStart = now;
+    }
+
+    const ProfileFrame& Profiler::GetFrame(size_t age)
+    {
+        static const ProfileFrame empty{};
+        if (age >= count) return empty;
+
+        return history[(head + HISTORY - 1 - age) % HISTORY];
+    }
+
+    size_t Profiler::GetFrameCount() { return count; }
+
+    float Profiler::GetPercentile(float p)
+    {
+        if (count == 0) return 0;
+
+        float totals[HISTORY];
+        for (size_t i = 0; i < count; i++) totals[i] = GetFrame(i).total;
+
+        size_t rank = static_cast<size_t>(std::clamp(p, 0.0f, 100.0f) / 100.0f * (count - 1) + 0.5f);
+        std::nth_element(totals, totals + rank, totals + count);
+
+        return totals[rank];
+    }
+
+    const char* Profiler::GetStageName(ProfileStage stage)
+    {
+        switch (stage)
+        {
+        case PROFILE_EVENTS: return "events";
+        case PROFILE_UPDATE: return "update";
+        case PROFILE_MAP: return "map";
+        case PROFILE_GOBLINS: return "goblins";
+        case PROFILE_RENDER: return "render";
+        case PROFILE_TEXT: return "text";
+        case PROFILE_PRESENT: return "present";
+        case PROFILE_DEBUG: return "debug";
+        case PROFILE_IDLE: return "idle";
+        case PROFILE_OTHER: return "other";
+        default: return "unknown";
+        }
+    }
+
+    SDL_Color Profiler::GetStageColor(ProfileStage stage)
+    {
+        switch (stage)
+        {
+        case PROFILE_EVENTS: return { 0x90, 0x90, 0x90, 0xC0 };
+        case PROFILE_UPDATE: return { 0x40, 0xA0, 0xFF, 0xC0 };
+        case PROFILE_MAP: return { 0x40, 0xD0, 0x60, 0xC0 };
+        case PROFILE_GOBLINS: return { 0xF0, 0xD0, 0x30, 0xC0 };
+        case PROFILE_RENDER: return { 0xF0, 0x70, 0x30, 0xC0 };
+        case PROFILE_TEXT: return { 0xD0, 0x50, 0xD0, 0xC0 };
+        case PROFILE_PRESENT: return { 0xE0, 0x40, 0x40, 0xC0 };
+        case PROFILE_DEBUG: return { 0x30, 0xD0, 0xD0, 0xC0 };
+        case PROFILE_IDLE: return { 0x50, 0x50, 0x70, 0xC0 };
+        case PROFILE_OTHER: return { 0xB0, 0xB0, 0x90, 0xC0 };
+        default: return { 0xFF, 0xFF, 0xFF, 0xC0 };
+        }
+    }
+
+    bool Profiler::DumpCsv(const std::string& path, size_t frames)
+    {
+        std::filesystem::path parent = std::filesystem::path(path).parent_path();
+        std::error_code error;
+        if (parent.empty() == false) std::filesystem::create_directories(parent, error);
+
+        std::ofstream o(path.c_str());
+        if (o.is_open() == false)
+        {
+            std::cout << "Unable to write profile: " << path << std::endl;
+            return false;
+        }
+
+        o << "frame,total";
+        for (Uint8 s = 0; s < PROFILE_STAGE_COUNT; s++) o << "," << GetStageName(static_cast<ProfileStage>(s));
+        o << ",drawCalls,textPages" << std::endl;
+
+        frames = std::min(frames, count);
+        for (size_t age = frames; age-- > 0;)
+        {
+            const ProfileFrame& frame = GetFrame(age);
+
+            o << frames - 1 - age << "," << frame.total;
+            for (Uint8 s = 0; s < PROFILE_STAGE_COUNT; s++) o << "," << frame.stages[s];
+            o << "," << frame.drawCalls << "," << frame.textPages << std::endl;
+        }
+
+        o.close();
+        std::cout << "Wrote " << frames << " frames to " << path << std::endl;
+
+        return true;
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <SDL.h>
+#include <string>
+
+// Per stage frame timings, kept for the last few seconds of frames
+namespace gobl
+{
+    enum ProfileStage : Uint8
+    {
+        PROFILE_EVENTS = 0,
+        PROFILE_UPDATE,
+        PROFILE_MAP,
+        PROFILE_GOBLINS,
+        PROFILE_RENDER,
+        PROFILE_TEXT,
+        PROFILE_PRESENT,
+        PROFILE_DEBUG,
+        PROFILE_IDLE, // Pacing sleep and waiting on vsync
+        PROFILE_OTHER, // Frame time outside every stage, keeps the stages summing to the total
+        PROFILE_STAGE_COUNT,
+    };
+
+    struct ProfileFrame
+    {
+        // Milliseconds spent in each stage, not counting stages nested inside it
+        float stages[PROFILE_STAGE_COUNT] = {};
+        float total = 0;
+        Uint32 drawCalls = 0;
+        Uint32 textPages = 0;
+    };
+
+    class Profiler
+    {
+    public:
+        static const size_t HISTORY = 256;
+        static const size_t MAX_DEPTH = 8;
+
+        static void Begin(ProfileStage stage);
+        static void End();
+        // Closes the frame being timed and moves it into the history
+        static void EndFrame(Uint32 drawCalls, Uint32 textPages);
+
+        // Age 0 is the last finished frame
+        static const ProfileFrame& GetFrame(size_t age);
+        static size_t GetFrameCount();
+        // Frame time in ms below which p percent (0-100) of the kept frames fall
+        static float GetPercentile(float p);
+
+        static const char* GetStageName(ProfileStage stage);
+        static SDL_Color GetStageColor(ProfileStage stage);
+
+        // Writes the newest frames oldest first, one row per frame
+        static bool DumpCsv(const std::string& path, size_t frames = HISTORY);
+    };
+
+    struct ProfileScope
+    {
+        ProfileScope(ProfileStage stage) { Profiler::Begin(stage); }
+        ~ProfileScope() { Profiler::End(); }
+
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+    };
+}
+
+#endif // !PROFILER_HPP
@@ -0,0 +1,337 @@
+#include "Raster.hpp"
+#include "GoblEngine.hpp"
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GOBL_RASTER_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(GOBL_RASTER_X86) && (defined(__GNUC__) || defined(__clang__))
+#define GOBL_TARGET_SSE2 __attribute__((target("sse2")))
+#define GOBL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define GOBL_TARGET_SSE2
+#define GOBL_TARGET_AVX2
+#endif
+
+// Pixels are RGBA8888, so in memory each one reads a, b, g, r and alpha is the lowest byte
+namespace gobl
+{
+    // Rounded x / 255, matches the vector kernels bit for bit
+    inline Uint32 Div255(Uint32 x)
+    {
+        x += 128;
+        return (x + (x >> 8)) >> 8;
+    }
+
+    inline Uint32 BlendPixel(Uint32 d, Uint32 s)
+    {
+        Uint32 a = s & 0xFF;
+        Uint32 ia = 0xFF - a;
+
+        Uint32 r = Div255(((s >> 24) & 0xFF) * a + ((d >> 24) & 0xFF) * ia);
+        Uint32 g = Div255(((s >> 16) & 0xFF) * a + ((d >> 16) & 0xFF) * ia);
+        Uint32 b = Div255(((s >> 8) & 0xFF) * a + ((d >> 8) & 0xFF) * ia);
+        Uint32 outA = Div255(a * 0xFF + (d & 0xFF) * ia);
+
+        return (r << 24) | (g << 16) | (b << 8) | outA;
+    }
+
+    inline Uint32 TintPixel(Uint32 s, Uint32 tint)
+    {
+        Uint32 r = Div255(((s >> 24) & 0xFF) * ((tint >> 24) & 0xFF));
+        Uint32 g = Div255(((s >> 16) & 0xFF) * ((tint >> 16) & 0xFF));
+        Uint32 b = Div255(((s >> 8) & 0xFF) * ((tint >> 8) & 0xFF));
+        Uint32 a = Div255((s & 0xFF) * (tint & 0xFF));
+
+        return (r << 24) | (g << 16) | (b << 8) | a;
+    }
+
+    // Scalar
+    void FillScalar(Uint32* dst, int count, Uint32 color) { std::fill(dst, dst + count, color); }
+
+    void BlendScalar(Uint32* dst, const Uint32* src, int count)
+    {
+        for (int i = 0; i < count; i++) dst[i] = BlendPixel(dst[i], src[i]);
+    }
+
+    void TintBlendScalar(Uint32* dst, const Uint32* src, int count, Uint32 tint)
+    {
+        for (int i = 0; i < count; i++) dst[i] = BlendPixel(dst[i], TintPixel(src[i], tint));
+    }
+
+#ifdef GOBL_RASTER_X86
+    // SSE2, four pixels at a time
+    GOBL_TARGET_SSE2 inline __m128i Div255SSE2(__m128i x)
+    {
+        x = _mm_add_epi16(x, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+    }
+
+    // Two pixels unpacked to 16 bit lanes
+    GOBL_TARGET_SSE2 inline __m128i BlendHalfSSE2(__m128i s, __m128i d)
+    {
+        const __m128i alphaLanes = _mm_set_epi16(0, 0, 0, 0xFF, 0, 0, 0, 0xFF);
+        const __m128i colorLanes = _mm_set_epi16(-1, -1, -1, 0, -1, -1, -1, 0);
+
+        __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(0, 0, 0, 0)), _MM_SHUFFLE(0, 0, 0, 0));
+        __m128i ia = _mm_sub_epi16(_mm_set1_epi16(0xFF), a);
+        __m128i sa = _mm_or_si128(_mm_and_si128(a, colorLanes), alphaLanes);
+
+        return Div255SSE2(_mm_add_epi16(_mm_mullo_epi16(s, sa), _mm_mullo_epi16(d, ia)));
+    }
+
+    GOBL_TARGET_SSE2 inline __m128i Blend4SSE2(__m128i s, __m128i d)
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        __m128i lo = BlendHalfSSE2(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i hi = BlendHalfSSE2(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    GOBL_TARGET_SSE2 inline __m128i Tint4SSE2(__m128i s, __m128i tint)
+    {
+        const __m128i zero = _mm_setzero_si128();
+
+        __m128i lo = Div255SSE2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), tint));
+        __m128i hi = Div255SSE2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), tint));
+
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    GOBL_TARGET_SSE2 void FillSSE2(Uint32* dst, int count, Uint32 color)
+    {
+        __m128i c = _mm_set1_epi32(static_cast<int>(color));
+        int i = 0;
+
+        for (; i + 4 <= count; i += 4) _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), c);
+        for (; i < count; i++) dst[i] = color;
+    }
+
+    GOBL_TARGET_SSE2 void BlendSSE2(Uint32* dst, const Uint32* src, int count)
+    {
+        int i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), Blend4SSE2(s, d));
+        }
+
+        for (; i < count; i++) dst[i] = BlendPixel(dst[i], src[i]);
+    }
+
+    GOBL_TARGET_SSE2 void TintBlendSSE2(Uint32* dst, const Uint32* src, int count, Uint32 tint)
+    {
+        // Tint lanes in memory order, a b g r, for both unpacked pixels
+        __m128i t = _mm_set_epi16(
+            static_cast<short>((tint >> 24) & 0xFF), static_cast<short>((tint >> 16) & 0xFF), static_cast<short>((tint >> 8) & 0xFF), static_cast<short>(tint & 0xFF),
+            static_cast<short>((tint >> 24) & 0xFF), static_cast<short>((tint >> 16) & 0xFF), static_cast<short>((tint >> 8) & 0xFF), static_cast<short>(tint & 0xFF));
+        int i = 0;
+
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128i s = Tint4SSE2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i)), t);
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), Blend4SSE2(s, d));
+        }
+
+        for (; i < count; i++) dst[i] = BlendPixel(dst[i], TintPixel(src[i], tint));
+    }
+
+    // AVX2, eight pixels at a time. Unpacking and packing both work per 128 bit lane so pixel order is kept.
+    GOBL_TARGET_AVX2 inline __m256i Div255AVX2(__m256i x)
+    {
+        x = _mm256_add_epi16(x, _mm256_set1_epi16(128));
+        return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+    }
+
+    GOBL_TARGET_AVX2 inline __m256i BlendHalfAVX2(__m256i s, __m256i d)
+    {
+        const __m256i alphaLanes = _mm256_set_epi16(0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF, 0, 0, 0, 0xFF);
+        const __m256i colorLanes = _mm256_set_epi16(-1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0, -1, -1, -1, 0);
+
+        __m256i a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(0, 0, 0, 0)), _MM_SHUFFLE(0, 0, 0, 0));
+        __m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(0xFF), a);
+        __m256i sa = _mm256_or_si256(_mm256_and_si256(a, colorLanes), alphaLanes);
+
+        return Div255AVX2(_mm256_add_epi16(_mm256_mullo_epi16(s, sa), _mm256_mullo_epi16(d, ia)));
+    }
+
+    GOBL_TARGET_AVX2 inline __m256i Blend8AVX2(__m256i s, __m256i d)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+
+        __m256i lo = BlendHalfAVX2(_mm256_unpacklo_epi8(s, zero), _mm256_unpacklo_epi8(d, zero));
+        __m256i hi = BlendHalfAVX2(_mm256_unpackhi_epi8(s, zero), _mm256_unpackhi_epi8(d, zero));
+
+        return _mm256_packus_epi16(lo, hi);
+    }
+
+    GOBL_TARGET_AVX2 void FillAVX2(Uint32* dst, int count, Uint32 color)
+    {
+        __m256i c = _mm256_set1_epi32(static_cast<int>(color));
+        int i = 0;
+
+        for (; i + 8 <= count; i += 8) _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), c);
+        for (; i < count; i++) dst[i] = color;
+    }
+
+    GOBL_TARGET_AVX2 void BlendAVX2(Uint32* dst, const Uint32* src, int count)
+    {
+        int i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), Blend8AVX2(s, d));
+        }
+
+        for (; i < count; i++) dst[i] = BlendPixel(dst[i], src[i]);
+    }
+
+    GOBL_TARGET_AVX2 void TintBlendAVX2(Uint32* dst, const Uint32* src, int count, Uint32 tint)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+
+        short r = static_cast<short>((tint >> 24) & 0xFF), g = static_cast<short>((tint >> 16) & 0xFF);
+        short b = static_cast<short>((tint >> 8) & 0xFF), a = static_cast<short>(tint & 0xFF);
+        __m256i t = _mm256_set_epi16(r, g, b, a, r, g, b, a, r, g, b, a, r, g, b, a);
+        int i = 0;
+
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+
+            __m256i lo = Div255AVX2(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), t));
+            __m256i hi = Div255AVX2(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), t));
+            s = _mm256_packus_epi16(lo, hi);
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), Blend8AVX2(s, d));
+        }
+
+        for (; i < count; i++) dst[i] = BlendPixel(dst[i], TintPixel(src[i], tint));
+    }
+#endif
+
+    const RasterKernels SCALAR_KERNELS{ "scalar", RASTER_SCALAR, FillScalar, BlendScalar, TintBlendScalar };
+#ifdef GOBL_RASTER_X86
+    const RasterKernels SSE2_KERNELS{ "sse2", RASTER_SSE2, FillSSE2, BlendSSE2, TintBlendSSE2 };
+    const RasterKernels AVX2_KERNELS{ "avx2", RASTER_AVX2, FillAVX2, BlendAVX2, TintBlendAVX2 };
+#endif
+
+    const RasterKernels& GetRasterKernels(RasterLevel level)
+    {
+#ifdef GOBL_RASTER_X86
+        if (level >= RASTER_AVX2 && SDL_HasAVX2()) return AVX2_KERNELS;
+        if (level >= RASTER_SSE2 && SDL_HasSSE2()) return SSE2_KERNELS;
+#endif
+        return SCALAR_KERNELS;
+    }
+
+    const RasterKernels& GetRasterKernels()
+    {
+        static const RasterKernels& best = GetRasterKernels(RASTER_AVX2);
+        return best;
+    }
+
+    // One direction of the blur, running sums per channel with the edges clamped
+    void BoxBlurLine(const Uint32* src, Uint32* dst, int length, int stride, int radius)
+    {
+        Uint32 sum[4] = {};
+        Uint32 count = radius * 2 + 1;
+
+        auto at = [&](int i) { return src[std::min(std::max(i, 0), length - 1) * stride]; };
+        auto add = [&](Uint32 p, int sign)
+        {
+            for (int c = 0; c < 4; c++) sum[c] += sign * ((p >> (c * 8)) & 0xFF);
+        };
+
+        for (int i = -radius; i <= radius; i++) add(at(i), 1);
+
+        for (int i = 0; i < length; i++)
+        {
+            Uint32 out = 0;
+            for (int c = 0; c < 4; c++) out |= ((sum[c] + count / 2) / count) << (c * 8);
+            dst[i * stride] = out;
+
+            add(at(i + radius + 1), 1);
+            add(at(i - radius), -1);
+        }
+    }
+
+    void BoxBlur(Uint32* pixels, Uint32* scratch, int w, int h, int radius, int passes)
+    {
+        if (radius <= 0 || w <= 0 || h <= 0) return;
+
+        for (int pass = 0; pass < passes; pass++)
+        {
+            for (int y = 0; y < h; y++) BoxBlurLine(&pixels[y * w], &scratch[y * w], w, 1, radius);
+            for (int x = 0; x < w; x++) BoxBlurLine(&scratch[x], &pixels[x], h, w, radius);
+        }
+    }
+
+    void BenchmarkRaster(int width, int height, int iterations)
+    {
+        const int count = width * height;
+        const int SPRITE_SIZE = 64;
+
+        std::vector<Uint32> buffer(count, 0);
+        std::vector<Uint32> sprite(SPRITE_SIZE * SPRITE_SIZE);
+        for (size_t i = 0; i < sprite.size(); i++) sprite[i] = ColorFromRGB(i % 255, (i / 3) % 255, 100, (i * 7) % 255);
+
+        double freq = static_cast<double>(SDL_GetPerformanceFrequency());
+        auto report = [&](const char* test, const char* name, Uint64 start)
+        {
+            double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / freq / iterations;
+            std::cout << "\t" << test << " (" << name << "): " << ms << "ms" << std::endl;
+        };
+
+        std::cout << "Raster benchmark " << width << "x" << height << ", " << iterations << " iterations" << std::endl;
+
+        // The loop ClearScreen used before the kernels
+        Color c{ 30, 60, 90, 0xFF };
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int n = 0; n < iterations; n++)
+            for (int i = 0; i < count; i++) buffer[i] = ColorFromRGB(c.r, c.g, c.b, c.a);
+        report("clear", "per pixel", start);
+
+        for (int level = RASTER_SCALAR; level <= RASTER_AVX2; level++)
+        {
+            const RasterKernels& k = GetRasterKernels(static_cast<RasterLevel>(level));
+            if (k.level != level) continue; // Not supported here
+
+            start = SDL_GetPerformanceCounter();
+            for (int n = 0; n < iterations; n++) k.fill(buffer.data(), count, ColorFromRGB(c.r, c.g, c.b, c.a));
+            report("clear", k.name, start);
+
+            // Cover the buffer in sprites
+            start = SDL_GetPerformanceCounter();
+            for (int n = 0; n < iterations; n++)
+                for (int y = 0; y + SPRITE_SIZE <= height; y += SPRITE_SIZE)
+                    for (int x = 0; x + SPRITE_SIZE <= width; x += SPRITE_SIZE)
+                        for (int row = 0; row < SPRITE_SIZE; row++)
+                            k.blend(&buffer[(y + row) * width + x], &sprite[row * SPRITE_SIZE], SPRITE_SIZE);
+            report("blend", k.name, start);
+
+            start = SDL_GetPerformanceCounter();
+            for (int n = 0; n < iterations; n++)
+                for (int y = 0; y + SPRITE_SIZE <= height; y += SPRITE_SIZE)
+                    for (int x = 0; x + SPRITE_SIZE <= width; x += SPRITE_SIZE)
+                        for (int row = 0; row < SPRITE_SIZE; row++)
+                            k.tintBlend(&buffer[(y + row) * width + x], &sprite[row * SPRITE_SIZE], SPRITE_SIZE, ColorFromRGB(200, 100, 50, 180));
+            report("tinted blend", k.name, start);
+        }
+    }
+}
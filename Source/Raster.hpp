@@ -0,0 +1,43 @@
+#pragma once
+#ifndef RASTER_HPP
+#define RASTER_HPP
+
+#include <SDL.h>
+
+// CPU raster kernels for RGBA8888 buffers, picked for the running CPU at startup
+namespace gobl
+{
+    enum RasterLevel : Uint8
+    {
+        RASTER_SCALAR = 0,
+        RASTER_SSE2 = 1,
+        RASTER_AVX2 = 2,
+    };
+
+    struct RasterKernels
+    {
+        const char* name = "scalar";
+        RasterLevel level = RASTER_SCALAR;
+
+        // Write one color over count pixels
+        void (*fill)(Uint32* dst, int count, Uint32 color) = nullptr;
+        // Alpha blend count source pixels over the destination
+        void (*blend)(Uint32* dst, const Uint32* src, int count) = nullptr;
+        // Multiply the source by tint, then alpha blend it over the destination
+        void (*tintBlend)(Uint32* dst, const Uint32* src, int count, Uint32 tint) = nullptr;
+    };
+
+    // The fastest kernels this CPU supports
+    const RasterKernels& GetRasterKernels();
+    // A specific level, falls back to the best supported one below it
+    const RasterKernels& GetRasterKernels(RasterLevel level);
+
+    // Separable box blur of a w x h RGBA8888 image in place, scratch must hold w * h pixels.
+    // A few passes approach a gaussian.
+    void BoxBlur(Uint32* pixels, Uint32* scratch, int w, int h, int radius, int passes = 2);
+
+    // Times the old per-pixel clear against each supported kernel level and prints the results
+    void BenchmarkRaster(int width = 1024, int height = 720, int iterations = 200);
+}
+
+#endif // !RASTER_HPP
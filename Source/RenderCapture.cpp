@@ -0,0 +1,237 @@
+#include "GoblEngine.hpp"
+#include "ByteStream.hpp"
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <type_traits>
+
+// Recording and replaying of the renderer's command stream.
+//
+// File layout, native byte order:
+//   header   "GRCP" Uint32 version, Sint32 width, Sint32 height
+//   texture  'T' Sint32 id, Sint32 w, Sint32 h, Uint16 length, path
+//   frame    'F' CameraTransform, Uint32 count, RenderCommand[count], Uint32 count, FillCommand[count],
+//                Uint32 count, TextCommand[count], Uint32 length, text
+// Texture records come before the first frame that uses the id, and again whenever the id is reused.
+namespace gobl
+{
+    namespace
+    {
+        const char CAPTURE_MAGIC[4] = { 'G', 'R', 'C', 'P' };
+        const Uint32 CAPTURE_VERSION = 1;
+        const Uint8 RECORD_TEXTURE = 'T';
+        const Uint8 RECORD_FRAME = 'F';
+
+        static_assert(std::is_trivially_copyable<RenderCommand>::value, "RenderCommand is written as raw bytes");
+        static_assert(std::is_trivially_copyable<CameraTransform>::value, "CameraTransform is written as raw bytes");
+    }
+
+    bool GoblRenderer::StartRecording()
+    {
+        recording = SDL_RWFromFile(recordPath.c_str(), "wb");
+        if (recording == NULL)
+        {
+            std::cout << "ERROR: Unable to record to " << recordPath << ": " << SDL_GetError() << std::endl;
+            return false;
+        }
+
+        recordBuffer.clear();
+        AppendBytes(recordBuffer, CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+        Append(recordBuffer, CAPTURE_VERSION);
+        Append(recordBuffer, static_cast<Sint32>(WINDOW_WIDTH));
+        Append(recordBuffer, static_cast<Sint32>(WINDOW_HEIGHT));
+        SDL_RWwrite(recording, recordBuffer.data(), 1, recordBuffer.size());
+
+        recordedTextures.clear();
+        std::cout << "Recording render commands to " << recordPath << std::endl;
+
+        return true;
+    }
+
+    void GoblRenderer::StopRecording()
+    {
+        if (recording == NULL) return;
+
+        SDL_RWclose(recording);
+        recording = NULL;
+        recordedTextures.clear();
+    }
+
+    void GoblRenderer::RecordFrame()
+    {
+        recordBuffer.clear();
+
+        for (auto& c : commands)
+        {
+            if (c.textureId < 0) continue;
+            SDL_Texture* texture = TextureManager::GetTexture(c.textureId);
+
+            auto recorded = recordedTextures.find(c.textureId);
+            if (recorded != recordedTextures.end() && recorded->second == texture) continue;
+            recordedTextures[c.textureId] = texture;
+
+            int w = 0, h = 0;
+            if (texture != nullptr) SDL_QueryTexture(texture, NULL, NULL, &w, &h);
+            const std::string& path = TextureManager::GetPath(c.textureId);
+
+            Append(recordBuffer, RECORD_TEXTURE);
+            Append(recordBuffer, static_cast<Sint32>(c.textureId));
+            Append(recordBuffer, static_cast<Sint32>(w));
+            Append(recordBuffer, static_cast<Sint32>(h));
+            Append(recordBuffer, static_cast<Uint16>(path.size()));
+            AppendBytes(recordBuffer, path.data(), path.size());
+        }
+
+        Append(recordBuffer, RECORD_FRAME);
+        Append(recordBuffer, camera != nullptr ? camera->GetTransform() : view);
+        AppendArray(recordBuffer, commands);
+        AppendArray(recordBuffer, fills);
+        AppendArray(recordBuffer, strings);
+        AppendArray(recordBuffer, textArena);
+
+        // One write per frame rather than one per value
+        SDL_RWwrite(recording, recordBuffer.data(), 1, recordBuffer.size());
+    }
+
+    bool GoblRenderer::Replay(const std::string& path, Uint32 loops)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (file.is_open() == false)
+        {
+            std::cout << "ERROR: Unable to open capture " << path << std::endl;
+            return false;
+        }
+
+        // Read up front so disk access stays out of the timings
+        std::vector<char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        ByteReader reader{ reinterpret_cast<const Uint8*>(data.data()), data.size() };
+
+        char magic[4]{};
+        reader.ReadBytes(magic, sizeof(magic));
+        Uint32 version = reader.Read<Uint32>();
+        Sint32 width = reader.Read<Sint32>();
+        Sint32 height = reader.Read<Sint32>();
+
+        if (reader.bad || std::memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 || version != CAPTURE_VERSION)
+        {
+            std::cout << "ERROR: " << path << " is not a version " << CAPTURE_VERSION << " render capture" << std::endl;
+            return false;
+        }
+
+        if (width != WINDOW_WIDTH || height != WINDOW_HEIGHT)
+            std::cout << "Capture was recorded at " << width << "x" << height << ", replaying at " << WINDOW_WIDTH << "x" << WINDOW_HEIGHT << std::endl;
+
+        Camera* previousCamera = camera;
+        camera = nullptr; // The recorded view is used instead
+
+        size_t framesStart = reader.pos;
+        std::unordered_map<int, int> textureIds{}; // Recorded id to the id it was recreated as
+        std::vector<int> recreated{}; // Every texture record's new id in file order, later loops reuse them
+        std::vector<int> created{};
+        std::vector<TextureHandle> loaded{};
+        std::vector<float> times{};
+        Uint64 totalDrawCalls = 0;
+
+        for (Uint32 loop = 0; loop < loops && reader.bad == false; loop++)
+        {
+            reader.pos = framesStart;
+            size_t record = 0;
+
+            while (reader.AtEnd() == false)
+            {
+                Uint8 tag = reader.Read<Uint8>();
+
+                if (tag == RECORD_TEXTURE)
+                {
+                    int id = reader.Read<Sint32>();
+                    int w = reader.Read<Sint32>();
+                    int h = reader.Read<Sint32>();
+                    std::string texturePath(reader.Read<Uint16>(), '\0');
+                    reader.ReadBytes(texturePath.data(), texturePath.size());
+
+                    if (loop > 0)
+                    {
+                        textureIds[id] = record < recreated.size() ? recreated[record++] : -1;
+                        continue;
+                    }
+
+                    // Files are loaded for real, anything made at runtime gets a white stand in of the same size
+                    TextureHandle handle{};
+                    if (texturePath.empty() == false) handle = TextureManager::Load(sdlRenderer, texturePath);
+
+                    if (TextureManager::IsValid(handle))
+                    {
+                        loaded.push_back(handle);
+                        textureIds[id] = handle.id;
+                        recreated.push_back(handle.id);
+                    }
+                    else
+                    {
+                        int stand = CreateBlankTexture(std::max(w, 1), std::max(h, 1));
+                        if (stand != -1)
+                        {
+                            std::vector<Uint32> white(static_cast<size_t>(std::max(w, 1)) * std::max(h, 1), 0xFFFFFFFF);
+                            SDL_UpdateTexture(TextureManager::GetTexture(stand), NULL, white.data(), std::max(w, 1) * sizeof(Uint32));
+                            created.push_back(stand);
+                        }
+
+                        textureIds[id] = stand;
+                        recreated.push_back(stand);
+                    }
+                }
+                else if (tag == RECORD_FRAME)
+                {
+                    view = reader.Read<CameraTransform>();
+                    reader.ReadArray(commands);
+                    reader.ReadArray(fills);
+                    reader.ReadArray(strings);
+                    reader.ReadArray(textArena);
+
+                    // Strings index into the arena, one that runs past it is corrupt
+                    for (auto& str : strings)
+                        if (static_cast<Uint64>(str.offset) + str.length > textArena.size()) reader.bad = true;
+                    if (reader.bad) break;
+
+                    for (auto& c : commands)
+                    {
+                        auto id = textureIds.find(c.textureId);
+                        c.textureId = id != textureIds.end() ? id->second : -1;
+                    }
+
+                    // Commands without a texture would be skipped by the game too, drop them here
+                    commands.erase(std::remove_if(commands.begin(), commands.end(), [](const RenderCommand& c) { return c.textureId == -1; }),
+                        commands.end());
+
+                    Uint64 start = SDL_GetPerformanceCounter();
+                    ClearPresentation();
+                    Present();
+                    times.push_back(static_cast<float>((SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency()));
+
+                    totalDrawCalls += drawCalls;
+                }
+                else reader.bad = true;
+            }
+        }
+
+        for (int id : created) TextureManager::DestroyTexture(id);
+        for (auto& handle : loaded) TextureManager::Release(handle);
+        camera = previousCamera;
+
+        if (reader.bad) std::cout << "ERROR: " << path << " is truncated or corrupt, stopped after " << times.size() << " frames" << std::endl;
+        if (times.empty()) return false;
+
+        std::vector<float> sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        auto percentile = [&](float p) { return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p / 100.0f * sorted.size()))]; };
+
+        double total = 0;
+        for (float t : times) total += t;
+
+        std::cout << "Replayed " << times.size() << " frames from " << path << std::endl;
+        std::cout << "  avg " << total / times.size() << " ms, p50 " << percentile(50) << " ms, p95 " << percentile(95)
+            << " ms, p99 " << percentile(99) << " ms, max " << sorted.back() << " ms" << std::endl;
+        std::cout << "  " << static_cast<double>(totalDrawCalls) / times.size() << " draw calls per frame" << std::endl;
+
+        return reader.bad == false;
+    }
+}
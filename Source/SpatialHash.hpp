@@ -0,0 +1,217 @@
+#pragma once
+#ifndef SPATIAL_HASH_H
+#define SPATIAL_HASH_H
+
+#include "GoblEngine.hpp"
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+namespace MAP
+{
+	// Entities bucketed by the map tile under their position, so "who is near here" only looks at nearby buckets.
+	// Buckets only exist where something stands, a huge mostly empty map costs nothing.
+	template<typename T>
+	class SpatialHash
+	{
+	private:
+		struct Entry
+		{
+			T* entity;
+			Vec2 pos;
+		};
+
+		struct Location
+		{
+			Uint64 key;
+			size_t index; // Within the bucket
+		};
+
+		float cellSize = 32.0f; // One map tile
+		std::unordered_map<Uint64, std::vector<Entry>> buckets{};
+		std::unordered_map<T*, Location> locations{};
+
+		static Uint64 MakeKey(int x, int y) { return (static_cast<Uint64>(static_cast<Uint32>(x)) << 32) | static_cast<Uint32>(y); }
+		int ToCell(float v) const { return static_cast<int>(std::floor(v / cellSize)); }
+
+		void RemoveAt(const Location& location)
+		{
+			auto bucket = buckets.find(location.key);
+			std::vector<Entry>& entries = bucket->second;
+
+			// Swap the last entry into the gap
+			entries[location.index] = entries.back();
+			locations[entries[location.index].entity].index = location.index;
+			entries.pop_back();
+
+			if (entries.empty()) buckets.erase(bucket);
+		}
+
+		void InsertAt(T* entity, Vec2 pos, Uint64 key)
+		{
+			std::vector<Entry>& entries = buckets[key];
+			locations[entity] = { key, entries.size() };
+			entries.push_back({ entity, pos });
+		}
+
+		// Visits every entry in the cells overlapping x0..x1, y0..y1, or every bucket when that is fewer
+		template<typename Visit>
+		void ForCells(int x0, int y0, int x1, int y1, Visit visit) const
+		{
+			Uint64 area = static_cast<Uint64>(x1 - x0 + 1) * static_cast<Uint64>(y1 - y0 + 1);
+
+			if (area > buckets.size())
+			{
+				for (auto& bucket : buckets)
+					for (auto& entry : bucket.second) visit(entry);
+				return;
+			}
+
+			for (int y = y0; y <= y1; y++)
+			{
+				for (int x = x0; x <= x1; x++)
+				{
+					auto bucket = buckets.find(MakeKey(x, y));
+					if (bucket == buckets.end()) continue;
+
+					for (auto& entry : bucket->second) visit(entry);
+				}
+			}
+		}
+
+	public:
+		SpatialHash() = default;
+		explicit SpatialHash(float cellSize) : cellSize(cellSize) {}
+
+		// Only valid while empty, cells should match the map's tile size
+		void SetCellSize(float size) { if (locations.empty() && size > 0.0f) cellSize = size; }
+
+		void Insert(T* entity, Vec2 pos)
+		{
+			if (locations.count(entity) != 0) Move(entity, pos);
+			else InsertAt(entity, pos, MakeKey(ToCell(pos.x), ToCell(pos.y)));
+		}
+
+		void Remove(T* entity)
+		{
+			auto location = locations.find(entity);
+			if (location == locations.end()) return;
+
+			RemoveAt(location->second);
+			locations.erase(location);
+		}
+
+		// Cheap while the entity stays on the same tile, only crossing tiles moves it between buckets
+		void Move(T* entity, Vec2 pos)
+		{
+			auto location = locations.find(entity);
+			if (location == locations.end()) return;
+
+			Uint64 key = MakeKey(ToCell(pos.x), ToCell(pos.y));
+			if (key == location->second.key)
+			{
+				buckets[key][location->second.index].pos = pos;
+				return;
+			}
+
+			RemoveAt(location->second);
+			InsertAt(entity, pos, key);
+		}
+
+		void Clear()
+		{
+			buckets.clear();
+			locations.clear();
+		}
+
+		size_t GetCount() const { return locations.size(); }
+
+		// Everything standing on a tile
+		void QueryTile(int x, int y, std::vector<T*>& out) const
+		{
+			auto bucket = buckets.find(MakeKey(x, y));
+			if (bucket == buckets.end()) return;
+
+			for (auto& entry : bucket->second) out.push_back(entry.entity);
+		}
+
+		// Everything whose position lies inside rect, in world units
+		void QueryRect(const SDL_FRect& rect, std::vector<T*>& out) const
+		{
+			ForCells(ToCell(rect.x), ToCell(rect.y), ToCell(rect.x + rect.w), ToCell(rect.y + rect.h), [&](const Entry& entry)
+			{
+				if (entry.pos.x >= rect.x && entry.pos.x <= rect.x + rect.w && entry.pos.y >= rect.y && entry.pos.y <= rect.y + rect.h)
+					out.push_back(entry.entity);
+			});
+		}
+
+		void QueryRadius(Vec2 center, float radius, std::vector<T*>& out) const
+		{
+			float r2 = radius * radius;
+
+			ForCells(ToCell(center.x - radius), ToCell(center.y - radius), ToCell(center.x + radius), ToCell(center.y + radius),
+				[&](const Entry& entry)
+			{
+				float dx = entry.pos.x - center.x, dy = entry.pos.y - center.y;
+				if (dx * dx + dy * dy <= r2) out.push_back(entry.entity);
+			});
+		}
+
+		// Closest entity within maxRadius that accept allows, searching outwards ring by ring. nullptr if none.
+		template<typename Accept>
+		T* Nearest(Vec2 center, float maxRadius, Accept accept) const
+		{
+			T* best = nullptr;
+			float bestD2 = maxRadius * maxRadius;
+
+			int cx = ToCell(center.x), cy = ToCell(center.y);
+			int rings = static_cast<int>(std::ceil(maxRadius / cellSize));
+
+			auto consider = [&](const Entry& entry)
+			{
+				float dx = entry.pos.x - center.x, dy = entry.pos.y - center.y;
+				float d2 = dx * dx + dy * dy;
+				if (d2 <= bestD2 && accept(entry.entity))
+				{
+					best = entry.entity;
+					bestD2 = d2;
+				}
+			};
+
+			// Few buckets left to look at, a flat pass is cheaper than walking empty rings
+			if (static_cast<Uint64>(rings * 2 + 1) * static_cast<Uint64>(rings * 2 + 1) > buckets.size())
+			{
+				for (auto& bucket : buckets)
+					for (auto& entry : bucket.second) consider(entry);
+				return best;
+			}
+
+			for (int ring = 0; ring <= rings; ring++)
+			{
+				// Nothing further out can beat what was found
+				float ringStart = (ring - 1) * cellSize;
+				if (best != nullptr && ringStart > 0.0f && ringStart * ringStart > bestD2) break;
+
+				for (int y = cy - ring; y <= cy + ring; y++)
+				{
+					// Only the edge of the square is new in this ring
+					int step = (y == cy - ring || y == cy + ring) ? 1 : ring * 2;
+
+					for (int x = cx - ring; x <= cx + ring; x += std::max(step, 1))
+					{
+						auto bucket = buckets.find(MakeKey(x, y));
+						if (bucket == buckets.end()) continue;
+
+						for (auto& entry : bucket->second) consider(entry);
+					}
+				}
+			}
+
+			return best;
+		}
+
+		T* Nearest(Vec2 center, float maxRadius) const { return Nearest(center, maxRadius, [](T*) { return true; }); }
+	};
+}
+
+#endif // !SPATIAL_HASH_H
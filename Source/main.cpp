@@ -1,11 +1,62 @@
 #include <iostream>
+#include <sstream>
 #include "GoblinsMain.hpp"
+#include "Raster.hpp"
 
+// --headless [frames] [--capture 10,20,30] [--capture-dir path] [--record file]
+// --replay file [loops] draws a recorded session headless and prints the frame times
 int main(int argc, char* argv[])
 {
+    gobl::HeadlessSettings headless{};
+    std::string recordPath{};
+
+    for (int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+
+        if (arg == "--bench-raster")
+        {
+            gobl::BenchmarkRaster();
+            return 0;
+        }
+        else if (arg == "--bench-objects")
+        {
+            MAP::Map::BenchmarkObjects();
+            return 0;
+        }
+        else if (arg == "--headless")
+        {
+            headless.enabled = true;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) headless.frameLimit = std::stoul(argv[++i]);
+        }
+        else if (arg == "--capture" && i + 1 < argc)
+        {
+            std::stringstream frames(argv[++i]);
+            std::string frame;
+
+            while (std::getline(frames, frame, ',')) if (frame.empty() == false) headless.captureFrames.push_back(std::stoul(frame));
+        }
+        else if (arg == "--capture-dir" && i + 1 < argc) headless.captureDirectory = argv[++i];
+        else if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            std::string path = argv[++i];
+            Uint32 loops = 1;
+            if (i + 1 < argc && std::isdigit(static_cast<unsigned char>(argv[i + 1][0]))) loops = std::stoul(argv[++i]);
+
+            gobl::GoblRenderer renderer{};
+            renderer.SetHeadless({ true });
+            if (renderer.Init() == false) return 1;
+
+            return renderer.Replay(path, loops) ? 0 : 1;
+        }
+    }
+
     srand(static_cast<unsigned int>(time(0)));
     GoblinsMain game{};
+    if (headless.enabled) game.SetHeadless(headless);
+    if (recordPath.empty() == false) game.SetRecordPath(recordPath);
     game.Launch();
 
     return 0;
-}
\ No newline at end of file
+}